@@ -0,0 +1,398 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+/* Measures the throughput of a child's output reaching a client, written
+ * to a descriptor the client passed in with "output-fd", and forwarded in
+ * ChildOutputReceived signals the way swupdd does otherwise. The signals
+ * go over a peer-to-peer connection by default, which is the best case,
+ * or through the broker of the system or session bus. */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <systemd/sd-bus.h>
+
+#include "bench.h"
+
+#define LINE_LEN 80
+
+typedef enum {
+	BUS_PEER,
+	BUS_SYSTEM,
+	BUS_USER
+} bus_kind_t;
+
+/* Writes size bytes of lines shaped like swupd's output, as swupd
+ * would */
+static void produce(int fd, uint64_t size)
+{
+	char block[LINE_LEN * 64];
+	uint64_t left = size;
+	size_t i;
+
+	for (i = 0; i < sizeof(block); i++) {
+		block[i] = (i % LINE_LEN == LINE_LEN - 1) ? '\n' : 'a' + i % 26;
+	}
+
+	while (left) {
+		size_t len = left < sizeof(block) ? left : sizeof(block);
+		ssize_t n = write(fd, block, len);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			_exit(EXIT_FAILURE);
+		}
+		left -= n;
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+static pid_t start_producer(int fd, uint64_t size)
+{
+	pid_t pid = fork();
+
+	if (pid == 0) {
+		produce(fd, size);
+	}
+
+	return pid;
+}
+
+/* The child writes to the client's descriptor directly */
+static uint64_t run_fd(uint64_t size)
+{
+	char buffer[64 * 1024];
+	uint64_t start, received = 0;
+	int fds[2];
+	pid_t pid;
+	ssize_t n;
+
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		perror("pipe2");
+		return 0;
+	}
+
+	start = bench_now();
+	pid = start_producer(fds[1], size);
+	close(fds[1]);
+	while ((n = read(fds[0], buffer, sizeof(buffer))) != 0) {
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			break;
+		}
+		received += n;
+	}
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+
+	return received == size ? bench_now() - start : 0;
+}
+
+static int open_bus(bus_kind_t kind, int fd, bool server, sd_bus **ret)
+{
+	sd_bus *bus = NULL;
+	int r;
+
+	if (kind == BUS_SYSTEM) {
+		return sd_bus_open_system(ret);
+	} else if (kind == BUS_USER) {
+		return sd_bus_open_user(ret);
+	}
+
+	r = sd_bus_new(&bus);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_set_fd(bus, fd, fd);
+	if (r < 0) {
+		goto finish;
+	}
+	if (server) {
+		sd_id128_t id;
+
+		r = sd_id128_randomize(&id);
+		if (r < 0) {
+			goto finish;
+		}
+		r = sd_bus_set_server(bus, true, id);
+		if (r < 0) {
+			goto finish;
+		}
+	}
+	r = sd_bus_start(bus);
+
+finish:
+	if (r < 0) {
+		sd_bus_unref(bus);
+		return r;
+	}
+	*ret = bus;
+	return 0;
+}
+
+/* Reads the child's output in chunks of flush_size and sends each one in
+ * a signal, as swupdd does with output_flush_lines disabled */
+static void forward(bus_kind_t kind, int bus_fd, int output_fd, size_t flush_size)
+{
+	sd_bus *bus = NULL;
+	char *buffer;
+	size_t len = 0;
+	ssize_t n;
+	int r;
+
+	buffer = malloc(flush_size + 1);
+	if (!buffer) {
+		_exit(EXIT_FAILURE);
+	}
+	r = open_bus(kind, bus_fd, true, &bus);
+	if (r < 0) {
+		fprintf(stderr, "Failed to open bus: %s\n", strerror(-r));
+		_exit(EXIT_FAILURE);
+	}
+
+	for (;;) {
+		n = read(output_fd, buffer + len, flush_size - len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n > 0) {
+			len += n;
+		}
+		if (len && (n <= 0 || len == flush_size)) {
+			buffer[len] = '\0';
+			r = sd_bus_emit_signal(bus, "/org/O1/swupdd/Client", "org.O1.swupdd.Client",
+					       "ChildOutputReceived", "s", buffer);
+			if (r < 0) {
+				fprintf(stderr, "Failed to emit signal: %s\n", strerror(-r));
+				_exit(EXIT_FAILURE);
+			}
+			len = 0;
+			/* as the daemon does, don't let the queue grow
+			 * without bounds */
+			while (sd_bus_process(bus, NULL) > 0) {}
+		}
+		if (n <= 0) {
+			break;
+		}
+	}
+
+	sd_bus_flush(bus);
+	sd_bus_flush_close_unref(bus);
+	_exit(EXIT_SUCCESS);
+}
+
+static int on_output(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+{
+	uint64_t *received = userdata;
+	const char *text;
+
+	if (sd_bus_message_read(m, "s", &text) >= 0) {
+		*received += strlen(text);
+	}
+
+	return 0;
+}
+
+/* The output goes through a forwarder reading it from the child and
+ * sending it in signals */
+static uint64_t run_signals(bus_kind_t kind, uint64_t size, size_t flush_size)
+{
+	sd_bus *bus = NULL;
+	uint64_t start, received = 0, elapsed = 0;
+	int sockets[2] = { -1, -1 };
+	int fds[2] = { -1, -1 };
+	pid_t producer = -1, forwarder = -1;
+	int r;
+
+	if (kind == BUS_PEER && socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) < 0) {
+		perror("socketpair");
+		return 0;
+	}
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		perror("pipe2");
+		goto finish;
+	}
+
+	r = open_bus(kind, sockets[0], false, &bus);
+	if (r < 0) {
+		fprintf(stderr, "Failed to open bus: %s\n", strerror(-r));
+		goto finish;
+	}
+	sockets[0] = -1;
+	/* installed before anything is sent, so no signal gets lost */
+	r = sd_bus_add_match(bus, NULL,
+			     "type='signal',"
+			     "interface='org.O1.swupdd.Client',"
+			     "member='ChildOutputReceived',"
+			     "path='/org/O1/swupdd/Client'",
+			     on_output, &received);
+	if (r < 0) {
+		fprintf(stderr, "Failed to add match: %s\n", strerror(-r));
+		goto finish;
+	}
+
+	start = bench_now();
+	forwarder = fork();
+	if (forwarder == 0) {
+		close(fds[1]);
+		forward(kind, sockets[1], fds[0], flush_size);
+	}
+	producer = start_producer(fds[1], size);
+	close(fds[0]);
+	close(fds[1]);
+	fds[0] = fds[1] = -1;
+
+	while (received < size) {
+		r = sd_bus_process(bus, NULL);
+		if (r < 0) {
+			fprintf(stderr, "Failed to process bus: %s\n", strerror(-r));
+			goto finish;
+		}
+		if (r == 0) {
+			r = sd_bus_wait(bus, 5 * 1000000);
+			if (r <= 0) {
+				fprintf(stderr, "Output stalled after %" PRIu64 " bytes\n", received);
+				goto finish;
+			}
+		}
+	}
+	elapsed = bench_now() - start;
+
+finish:
+	if (producer > 0) {
+		waitpid(producer, NULL, 0);
+	}
+	if (forwarder > 0) {
+		if (!elapsed) {
+			kill(forwarder, SIGTERM);
+		}
+		waitpid(forwarder, NULL, 0);
+	}
+	sd_bus_flush_close_unref(bus);
+	if (sockets[0] >= 0) {
+		close(sockets[0]);
+	}
+	if (sockets[1] >= 0) {
+		close(sockets[1]);
+	}
+	if (fds[0] >= 0) {
+		close(fds[0]);
+	}
+	if (fds[1] >= 0) {
+		close(fds[1]);
+	}
+
+	return elapsed;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-s size MB] [-f flush size KB] [-n runs] [-b peer|system|user]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	bus_kind_t kind = BUS_PEER;
+	unsigned long size_mb = 64;
+	unsigned long flush_kb = 16;
+	unsigned long runs = 3;
+	uint64_t size;
+	uint64_t best_fd = 0, best_signals = 0;
+	unsigned long i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hs:f:n:b:")) != -1) {
+		switch (opt) {
+		case 's':
+			size_mb = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			flush_kb = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			runs = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			if (strcmp(optarg, "peer") == 0) {
+				kind = BUS_PEER;
+			} else if (strcmp(optarg, "system") == 0) {
+				kind = BUS_SYSTEM;
+			} else if (strcmp(optarg, "user") == 0) {
+				kind = BUS_USER;
+			} else {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!size_mb || !flush_kb || !runs) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	size = (uint64_t) size_mb << 20;
+
+	/* the best of several runs, the others only saw more noise */
+	for (i = 0; i < runs; i++) {
+		uint64_t usec;
+
+		usec = run_fd(size);
+		if (usec && (!best_fd || usec < best_fd)) {
+			best_fd = usec;
+		}
+		usec = run_signals(kind, size, flush_kb << 10);
+		if (usec && (!best_signals || usec < best_signals)) {
+			best_signals = usec;
+		}
+	}
+
+	printf("Output throughput, %lu MB in %lu KB signals over %s\n", size_mb, flush_kb,
+	       kind == BUS_PEER ? "a direct connection" : kind == BUS_SYSTEM ? "the system bus" : "the session bus");
+	if (best_fd) {
+		bench_report_rate("output-fd", size, best_fd);
+	}
+	if (best_signals) {
+		bench_report_rate("ChildOutputReceived", size, best_signals);
+	}
+
+	return best_fd && best_signals ? EXIT_SUCCESS : EXIT_FAILURE;
+}
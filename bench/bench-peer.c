@@ -0,0 +1,308 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+/* Measures a running swupdd over its private socket and over the system
+ * bus: the time it takes to connect and get a first answer, as every
+ * swupdctl invocation does, the round trip of a call, and the throughput
+ * of the output it keeps for jobs. Output is read with GetJobOutput from
+ * the job with the most output unless one is given. */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <systemd/sd-bus.h>
+
+#include "peer.h"
+#include "bench.h"
+
+#define SWUPDD_NAME "org.O1.swupdd.Client"
+#define SWUPDD_PATH "/org/O1/swupdd/Client"
+
+static int open_path(bool direct, sd_bus **ret)
+{
+	sd_bus *bus = NULL;
+	int r;
+
+	if (!direct) {
+		return sd_bus_open_system(ret);
+	}
+
+	r = sd_bus_new(&bus);
+	if (r >= 0) {
+		r = sd_bus_set_address(bus, "unix:path=" PEER_SOCKET_PATH);
+	}
+	if (r >= 0) {
+		r = sd_bus_start(bus);
+	}
+	if (r < 0) {
+		sd_bus_unref(bus);
+		return r;
+	}
+	*ret = bus;
+	return 0;
+}
+
+/* A cheap call the daemon answers itself rather than sd-bus */
+static int call_daemon(sd_bus *bus, bool direct)
+{
+	sd_bus_error error = SD_BUS_ERROR_NULL;
+	uint32_t len;
+	int r;
+
+	r = sd_bus_get_property_trivial(bus, direct ? NULL : SWUPDD_NAME, SWUPDD_PATH, SWUPDD_NAME,
+					"QueueLength", &error, 'u', &len);
+	if (r < 0) {
+		fprintf(stderr, "Failed to call swupdd: %s\n", error.message ? error.message : strerror(-r));
+	}
+	sd_bus_error_free(&error);
+
+	return r;
+}
+
+static int measure_connect(bool direct, uint64_t *samples, size_t runs, size_t *n)
+{
+	size_t i;
+	int r;
+
+	*n = 0;
+	for (i = 0; i < runs; i++) {
+		sd_bus *bus = NULL;
+		uint64_t start = bench_now();
+
+		r = open_path(direct, &bus);
+		if (r < 0) {
+			fprintf(stderr, "Failed to connect: %s\n", strerror(-r));
+			return r;
+		}
+		r = call_daemon(bus, direct);
+		sd_bus_flush_close_unref(bus);
+		if (r < 0) {
+			return r;
+		}
+		samples[(*n)++] = bench_now() - start;
+	}
+
+	return 0;
+}
+
+static int measure_calls(sd_bus *bus, bool direct, uint64_t *samples, size_t runs, size_t *n)
+{
+	size_t i;
+	int r;
+
+	*n = 0;
+	for (i = 0; i < runs; i++) {
+		uint64_t start = bench_now();
+
+		r = call_daemon(bus, direct);
+		if (r < 0) {
+			return r;
+		}
+		samples[(*n)++] = bench_now() - start;
+	}
+
+	return 0;
+}
+
+/* Returns the id of the job with the most output kept, or 0 */
+static uint64_t find_output_job(sd_bus *bus, bool direct)
+{
+	sd_bus_error error = SD_BUS_ERROR_NULL;
+	sd_bus_message *reply = NULL;
+	uint64_t best = 0, best_end = 0;
+	uint64_t id, end;
+	const char *method, *state;
+	int r;
+
+	r = sd_bus_call_method(bus, direct ? NULL : SWUPDD_NAME, SWUPDD_PATH, SWUPDD_NAME,
+			       "ListJobs", &error, &reply, "");
+	if (r < 0) {
+		fprintf(stderr, "Failed to list jobs: %s\n", error.message ? error.message : strerror(-r));
+		goto finish;
+	}
+	r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_ARRAY, "(tsst)");
+	if (r < 0) {
+		goto finish;
+	}
+	while ((r = sd_bus_message_read(reply, "(tsst)", &id, &method, &state, &end)) > 0) {
+		if (end > best_end) {
+			best = id;
+			best_end = end;
+		}
+	}
+
+finish:
+	sd_bus_error_free(&error);
+	sd_bus_message_unref(reply);
+	return best;
+}
+
+/* Reads the output kept for the job over and over, returns the time it
+ * took or 0 on failure */
+static uint64_t measure_output(sd_bus *bus, bool direct, uint64_t job, uint32_t chunk,
+			       size_t runs, uint64_t *bytes)
+{
+	uint64_t start = bench_now();
+	size_t i;
+	int r;
+
+	*bytes = 0;
+	for (i = 0; i < runs; i++) {
+		sd_bus_error error = SD_BUS_ERROR_NULL;
+		sd_bus_message *reply = NULL;
+		uint64_t offset;
+		const void *data;
+		size_t len;
+
+		r = sd_bus_call_method(bus, direct ? NULL : SWUPDD_NAME, SWUPDD_PATH, SWUPDD_NAME,
+				       "GetJobOutput", &error, &reply, "ttu", job, (uint64_t) 0, chunk);
+		if (r >= 0) {
+			r = sd_bus_message_read(reply, "t", &offset);
+		}
+		if (r >= 0) {
+			r = sd_bus_message_read_array(reply, SD_BUS_TYPE_BYTE, &data, &len);
+		}
+		if (r < 0) {
+			fprintf(stderr, "Failed to get output: %s\n",
+				error.message ? error.message : strerror(-r));
+		}
+		sd_bus_error_free(&error);
+		sd_bus_message_unref(reply);
+		if (r < 0) {
+			return 0;
+		}
+		*bytes += len;
+	}
+
+	return bench_now() - start;
+}
+
+static int run_path(bool direct, size_t runs, uint64_t job, uint32_t chunk)
+{
+	const char *label = direct ? "direct" : "system bus";
+	char name[64];
+	sd_bus *bus = NULL;
+	uint64_t *samples;
+	uint64_t bytes, usec;
+	size_t n;
+	int r;
+
+	samples = calloc(runs, sizeof(uint64_t));
+	if (!samples) {
+		return -ENOMEM;
+	}
+
+	r = measure_connect(direct, samples, runs, &n);
+	if (r < 0) {
+		goto finish;
+	}
+	snprintf(name, sizeof(name), "%s connect", label);
+	bench_report(name, samples, n);
+
+	r = open_path(direct, &bus);
+	if (r < 0) {
+		goto finish;
+	}
+	r = measure_calls(bus, direct, samples, runs, &n);
+	if (r < 0) {
+		goto finish;
+	}
+	snprintf(name, sizeof(name), "%s call", label);
+	bench_report(name, samples, n);
+
+	if (!job) {
+		job = find_output_job(bus, direct);
+	}
+	if (!job) {
+		printf("%s: no job output to read\n", label);
+		goto finish;
+	}
+	usec = measure_output(bus, direct, job, chunk, runs, &bytes);
+	if (!usec) {
+		r = -EIO;
+		goto finish;
+	}
+	snprintf(name, sizeof(name), "%s output", label);
+	bench_report_rate(name, bytes, usec);
+
+finish:
+	sd_bus_flush_close_unref(bus);
+	free(samples);
+	return r;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n runs] [-j job id] [-c chunk KB] [-p direct|bus|both]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	bool direct = true, system = true;
+	unsigned long runs = 1000;
+	unsigned long chunk_kb = 64;
+	uint64_t job = 0;
+	int opt;
+	int r = 0;
+
+	while ((opt = getopt(argc, argv, "hn:j:c:p:")) != -1) {
+		switch (opt) {
+		case 'n':
+			runs = strtoul(optarg, NULL, 10);
+			break;
+		case 'j':
+			job = strtoull(optarg, NULL, 10);
+			break;
+		case 'c':
+			chunk_kb = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			direct = strcmp(optarg, "bus") != 0;
+			system = strcmp(optarg, "direct") != 0;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!runs || !chunk_kb) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (direct) {
+		r = run_path(true, runs, job, chunk_kb << 10);
+	}
+	if (system && r >= 0) {
+		r = run_path(false, runs, job, chunk_kb << 10);
+	}
+
+	return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
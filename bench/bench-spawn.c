@@ -0,0 +1,236 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+/* Measures the time from starting a child until its first output arrives,
+ * for fork() followed by execvp() as swupdd used to do and for the spawn
+ * path of child.c. The daemon's heap can be simulated, as fork() gets
+ * slower the more memory has to be mapped into the child. With -g the
+ * gated spawn resource control uses is measured as well, its gate is
+ * released right away. */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "child.h"
+#include "bench.h"
+
+extern char **environ;
+
+static pid_t spawn_fork(char **argv, int out_fd)
+{
+	pid_t pid = fork();
+
+	if (pid == 0) {
+		char **args;
+		int n = 0;
+
+		/* the argv copy run_swupd() used to make in the child */
+		while (argv[n]) {
+			n++;
+		}
+		args = calloc(n + 1, sizeof(char *));
+		if (!args) {
+			_exit(127);
+		}
+		memcpy(args, argv, n * sizeof(char *));
+
+		dup2(out_fd, STDOUT_FILENO);
+		execvp(args[0], args);
+		_exit(127);
+	}
+
+	return pid < 0 ? -errno : pid;
+}
+
+typedef enum {
+	SPAWN_FORK,
+	SPAWN_CHILD,
+	SPAWN_CHILD_GATED,
+	SPAWN_MAX
+} spawn_mode_t;
+
+static pid_t spawn_child(char **argv, int out_fd, int exec_fd, const char *path, bool gated)
+{
+	child_attr_t attr = {
+		.exec_fd = exec_fd,
+		.path = path,
+		.argv = argv,
+		.envp = environ,
+		.stdout_fd = out_fd,
+		.stderr_fd = STDERR_FILENO,
+		.gated = gated,
+	};
+	int gate_fd = -1;
+	pid_t pid;
+
+	pid = child_spawn(&attr, NULL, &gate_fd);
+	if (pid > 0 && gated) {
+		child_release(gate_fd, true);
+	}
+
+	return pid;
+}
+
+/* Returns the time until the first byte of output, or 0 on failure */
+static uint64_t run_once(spawn_mode_t mode, char **argv, int exec_fd, const char *path)
+{
+	char buffer[4096];
+	uint64_t start, latency = 0;
+	int fds[2];
+	pid_t pid;
+	ssize_t n;
+
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		perror("pipe2");
+		return 0;
+	}
+
+	start = bench_now();
+	if (mode == SPAWN_FORK) {
+		pid = spawn_fork(argv, fds[1]);
+	} else {
+		pid = spawn_child(argv, fds[1], exec_fd, path, mode == SPAWN_CHILD_GATED);
+	}
+	close(fds[1]);
+	if (pid < 0) {
+		fprintf(stderr, "Failed to start %s: %s\n", argv[0], strerror(-pid));
+		close(fds[0]);
+		return 0;
+	}
+
+	n = read(fds[0], buffer, sizeof(buffer));
+	if (n > 0) {
+		latency = bench_now() - start;
+	}
+	while (n > 0 || (n < 0 && errno == EINTR)) {
+		n = read(fds[0], buffer, sizeof(buffer));
+	}
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+
+	return latency;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-g] [-n runs] [-m heap MB] [command [args...]]\n", name);
+	printf("The command must write to stdout, it defaults to \"echo spawned\".\n");
+}
+
+int main(int argc, char **argv)
+{
+	static char *default_argv[] = { "echo", "spawned", NULL };
+	char **command = default_argv;
+	unsigned long runs = 200;
+	unsigned long heap_mb = 0;
+	static const char *names[SPAWN_MAX] = { "fork+execvp", "child_spawn", "child_spawn gated" };
+	uint64_t *samples[SPAWN_MAX] = { NULL };
+	size_t counts[SPAWN_MAX] = { 0 };
+	spawn_mode_t modes = SPAWN_CHILD_GATED;
+	spawn_mode_t mode;
+	char *heap = NULL;
+	char *path = NULL;
+	int exec_fd = -1;
+	unsigned long i;
+	int opt;
+	int r;
+
+	while ((opt = getopt(argc, argv, "+hgn:m:")) != -1) {
+		switch (opt) {
+		case 'g':
+			modes = SPAWN_MAX;
+			break;
+		case 'n':
+			runs = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			heap_mb = strtoul(optarg, NULL, 10);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc) {
+		command = argv + optind;
+	}
+	if (!runs) {
+		runs = 1;
+	}
+
+	/* touched so that the pages are really mapped */
+	if (heap_mb) {
+		heap = malloc(heap_mb << 20);
+		if (!heap) {
+			fprintf(stderr, "Can't allocate %lu MB\n", heap_mb);
+			return EXIT_FAILURE;
+		}
+		memset(heap, 1, heap_mb << 20);
+	}
+
+	r = child_resolve(command[0], &path, &exec_fd);
+	if (r < 0) {
+		fprintf(stderr, "Can't find %s: %s\n", command[0], strerror(-r));
+		return EXIT_FAILURE;
+	}
+
+	for (mode = 0; mode < modes; mode++) {
+		samples[mode] = calloc(runs, sizeof(uint64_t));
+		if (!samples[mode]) {
+			fprintf(stderr, "Can't allocate memory\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* alternated, so that all see the same conditions */
+	for (i = 0; i < runs; i++) {
+		for (mode = 0; mode < modes; mode++) {
+			uint64_t usec = run_once(mode, command, exec_fd, path);
+
+			if (usec) {
+				samples[mode][counts[mode]++] = usec;
+			}
+		}
+	}
+
+	printf("Spawn to first output of %s, %lu MB heap\n", path, heap_mb);
+	for (mode = 0; mode < modes; mode++) {
+		bench_report(names[mode], samples[mode], counts[mode]);
+		free(samples[mode]);
+	}
+	free(heap);
+	free(path);
+	close(exec_fd);
+
+	return EXIT_SUCCESS;
+}
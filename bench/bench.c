@@ -0,0 +1,70 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "bench.h"
+
+uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+void bench_report(const char *name, uint64_t *samples, size_t n)
+{
+	uint64_t sum = 0;
+	size_t i;
+
+	if (!n) {
+		printf("%-24s no samples\n", name);
+		return;
+	}
+
+	qsort(samples, n, sizeof(uint64_t), compare_samples);
+	for (i = 0; i < n; i++) {
+		sum += samples[i];
+	}
+	printf("%-24s min %6" PRIu64 "us  median %6" PRIu64 "us  p90 %6" PRIu64 "us  mean %6" PRIu64 "us  (%zu runs)\n",
+	       name, samples[0], samples[n / 2], samples[n * 9 / 10], sum / n, n);
+}
+
+void bench_report_rate(const char *name, uint64_t bytes, uint64_t usec)
+{
+	if (!usec) {
+		usec = 1;
+	}
+	printf("%-24s %8.1f MB/s  (%" PRIu64 " bytes in %" PRIu64 "us)\n",
+	       name, (double) bytes / usec, bytes, usec);
+}
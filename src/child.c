@@ -0,0 +1,256 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "child.h"
+
+#define CHILD_STACK_SIZE (64 * 1024)
+#define IOPRIO_WHO_PROCESS 1
+
+/* The child borrows this stack only until it execs, the parent is
+ * suspended meanwhile thanks to CLONE_VFORK */
+static char _child_stack[CHILD_STACK_SIZE] __attribute__((aligned(16)));
+
+int child_resolve(const char *name, char **path, int *fd)
+{
+	const char *search = getenv("PATH");
+	const char *dir;
+	const char *end;
+	int r;
+
+	if (strchr(name, '/')) {
+		*fd = open(name, O_PATH | O_CLOEXEC);
+		if (*fd < 0) {
+			return -errno;
+		}
+		*path = strdup(name);
+		return *path ? 0 : -ENOMEM;
+	}
+
+	if (!search) {
+		search = "/usr/local/bin:/usr/bin:/bin";
+	}
+
+	for (dir = search; *dir; dir = *end ? end + 1 : end) {
+		char *candidate;
+		struct stat st;
+
+		end = strchrnul(dir, ':');
+		/* an empty entry stands for the current directory */
+		if (end == dir) {
+			r = asprintf(&candidate, "./%s", name);
+		} else {
+			r = asprintf(&candidate, "%.*s/%s", (int)(end - dir), dir, name);
+		}
+		if (r < 0) {
+			return -ENOMEM;
+		}
+
+		if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) &&
+		    access(candidate, X_OK) == 0) {
+			*fd = open(candidate, O_PATH | O_CLOEXEC);
+			if (*fd >= 0) {
+				*path = candidate;
+				return 0;
+			}
+		}
+		free(candidate);
+	}
+
+	return -ENOENT;
+}
+
+/* pid 0 stands for the calling process */
+static void child_set_priority(pid_t pid, const child_attr_t *attr)
+{
+	if (attr->nice != CHILD_NICE_INHERIT) {
+		setpriority(PRIO_PROCESS, pid, attr->nice);
+	}
+	if (attr->ioprio) {
+		syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, attr->ioprio);
+	}
+}
+
+typedef struct _child_start {
+	const child_attr_t *attr;
+	/* the gate of a gated child, { -1, -1 } otherwise */
+	int gate[2];
+} child_start_t;
+
+static int child_main(void *data)
+{
+	const child_start_t *start = data;
+	const child_attr_t *attr = start->attr;
+	sigset_t ss;
+
+	/* The daemon keeps SIGCHLD blocked for its signalfd, swupd must
+	 * not inherit that */
+	sigemptyset(&ss);
+	sigprocmask(SIG_SETMASK, &ss, NULL);
+
+	child_set_priority(0, attr);
+	if (attr->new_group) {
+		setpgid(0, 0);
+	}
+
+	while ((dup2(attr->stderr_fd, STDERR_FILENO) == -1) && (errno == EINTR)) {}
+	while ((dup2(attr->stdout_fd, STDOUT_FILENO) == -1) && (errno == EINTR)) {}
+
+	/* Only a byte lets the child through, EOF means the daemon gave up
+	 * on it or is gone */
+	if (start->gate[0] >= 0) {
+		char go = 0;
+		ssize_t n;
+
+		close(start->gate[1]);
+		while ((n = read(start->gate[0], &go, 1)) < 0 && errno == EINTR) {}
+		if (n != 1 || !go) {
+			_exit(127);
+		}
+		close(start->gate[0]);
+	}
+
+	if (attr->exec_fd >= 0) {
+		syscall(SYS_execveat, attr->exec_fd, "", attr->argv, attr->envp, AT_EMPTY_PATH);
+	}
+	execve(attr->path, attr->argv, attr->envp);
+
+	_exit(127);
+}
+
+static pid_t child_spawn_posix(const child_attr_t *attr)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t spawnattr;
+	sigset_t ss;
+	pid_t pid;
+	int r;
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, attr->stderr_fd, STDERR_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, attr->stdout_fd, STDOUT_FILENO);
+
+	sigemptyset(&ss);
+	posix_spawnattr_init(&spawnattr);
+	posix_spawnattr_setsigmask(&spawnattr, &ss);
+	if (attr->new_group) {
+		posix_spawnattr_setpgroup(&spawnattr, 0);
+		posix_spawnattr_setflags(&spawnattr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+	} else {
+		posix_spawnattr_setflags(&spawnattr, POSIX_SPAWN_SETSIGMASK);
+	}
+
+	r = posix_spawn(&pid, attr->path, &actions, &spawnattr, attr->argv, attr->envp);
+	if (r == 0) {
+		/* posix_spawn() offers no way to do that in the child, so
+		 * swupd starts with the daemon's priority for a moment */
+		child_set_priority(pid, attr);
+	}
+
+	posix_spawnattr_destroy(&spawnattr);
+	posix_spawn_file_actions_destroy(&actions);
+
+	return r ? -r : pid;
+}
+
+pid_t child_spawn(const child_attr_t *attr, int *pidfd, int *gate_fd)
+{
+	child_start_t start = { attr, { -1, -1 } };
+	int flags = CLONE_VM | CLONE_VFORK | CLONE_PIDFD | SIGCHLD;
+	int fd = -1;
+	pid_t pid;
+
+	if (attr->gated) {
+		if (pipe2(start.gate, O_CLOEXEC) < 0) {
+			return -errno;
+		}
+		flags &= ~(CLONE_VM | CLONE_VFORK);
+	}
+
+	pid = clone(child_main, _child_stack + CHILD_STACK_SIZE, flags, &start, &fd);
+	if (pid < 0 && errno == EINVAL && attr->gated) {
+		/* Kernels older than 5.2 know nothing about pidfds */
+		pid = fork();
+		if (pid == 0) {
+			_exit(child_main(&start));
+		} else if (pid < 0) {
+			pid = -errno;
+		}
+		fd = -1;
+	} else if (pid < 0 && errno == EINVAL) {
+		pid = child_spawn_posix(attr);
+		fd = -1;
+	} else if (pid < 0) {
+		pid = -errno;
+	}
+
+	if (start.gate[0] >= 0) {
+		close(start.gate[0]);
+		if (pid < 0) {
+			close(start.gate[1]);
+		} else {
+			*gate_fd = start.gate[1];
+		}
+	}
+	if (pidfd) {
+		*pidfd = fd;
+	} else if (fd >= 0) {
+		close(fd);
+	}
+
+	return pid;
+}
+
+int child_release(int gate_fd, bool run)
+{
+	char go = 1;
+	int r = 0;
+
+	if (run && write(gate_fd, &go, 1) < 0) {
+		r = -errno;
+	}
+	close(gate_fd);
+
+	return r;
+}
+
+int child_kill(pid_t pid, int pidfd, int sig)
+{
+	if (pidfd >= 0) {
+		return syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0) < 0 ? -errno : 0;
+	}
+
+	return kill(pid, sig) < 0 ? -errno : 0;
+}
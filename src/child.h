@@ -0,0 +1,71 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#ifndef CHILD_H
+#define CHILD_H
+
+#include <stdbool.h>
+#include <limits.h>
+#include <sys/types.h>
+
+#define CHILD_NICE_INHERIT INT_MIN
+
+typedef struct _child_attr {
+	/* O_PATH descriptor of the executable, or -1 to exec path */
+	int exec_fd;
+	const char *path;
+	char **argv;
+	char **envp;
+	/* descriptors the child gets as its stdout and stderr */
+	int stdout_fd;
+	int stderr_fd;
+	/* nice value and ioprio_set(2) value of the child, CHILD_NICE_INHERIT
+	 * and 0 to inherit the daemon's ones */
+	int nice;
+	int ioprio;
+	/* put the child into a process group of its own */
+	bool new_group;
+	/* hold the child back before it execs until child_release() */
+	bool gated;
+} child_attr_t;
+
+/* Looks up name in $PATH the way execvp() does. On success stores the
+ * absolute path in *path and an O_PATH descriptor of the file in *fd. */
+int child_resolve(const char *name, char **path, int *fd);
+
+/* Starts a child process without duplicating the daemon's address space.
+ * Returns the pid of the child or a negative errno. If pidfd is not NULL
+ * it receives a pid file descriptor of the child, or -1 if the kernel
+ * doesn't support them. A gated child has to wait, which it can't do
+ * while sharing the daemon's memory, so it gets a copy of it. gate_fd
+ * then receives the descriptor to release it with. */
+pid_t child_spawn(const child_attr_t *attr, int *pidfd, int *gate_fd);
+
+/* Lets a gated child exec, or makes it exit with 127 right away unless
+ * run is set. Closing the descriptor, e.g. because the daemon dies, does
+ * the latter as well. Takes over gate_fd. */
+int child_release(int gate_fd, bool run);
+
+/* Sends a signal through the pid file descriptor if there is one, which
+ * can't hit an unrelated process reusing the pid */
+int child_kill(pid_t pid, int pidfd, int sig);
+
+#endif /* CHILD_H */
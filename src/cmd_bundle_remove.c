@@ -33,7 +33,7 @@
 static void print_help(const char *name)
 {
 	printf("Usage:\n");
-	printf("   swupd %s [options] bundlename\n\n", basename((char *)name));
+	printf("   swupd %s [options] [bundle1 bundle2 (...)]\n\n", basename((char *)name));
 	printf("Help Options:\n");
 	printf("   -h, --help              Show help options\n");
 	printf("   -p, --path=[PATH...]    Use [PATH...] as the path to verify (eg: a chroot or btrfs subvol\n");
@@ -158,7 +158,7 @@ int bundle_remove_main(int argc, char **argv)
 		goto finish;
 	}
 
-        ret = dbus_client_call_method("BundleRemove", opts, DBUS_CMD_SINGLE_ARG, (argv + optind));
+        ret = dbus_client_call_method("BundleRemove", opts, DBUS_CMD_MULTIPLE_ARGS, (argv + optind));
 
 finish:
 	list_free_list_and_data(opts, free_command_option);
@@ -0,0 +1,134 @@
+/*
+ *   Software Updater - D-Bus client for the daemon controlling
+ *                      Clear Linux Software Update Client.
+ *
+ *      Copyright © 2016 Intel Corporation.
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ */
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+
+#include "status.h"
+
+static void print_help(const char *name)
+{
+	printf("Usage:\n");
+	printf("   swupd %s [OPTION...]\n\n", basename((char *)name));
+	printf("Help Options:\n");
+	printf("   -h, --help              Show help options\n\n");
+	printf("Shows the state the daemon publishes in %s, without talking to it.\n", STATUS_PAGE_PATH);
+	printf("\n");
+}
+
+static const struct option prog_opts[] = {
+	{ "help", 0, NULL, 'h' },
+	{ 0, 0, 0, 0 }
+};
+
+static void print_time(const char *label, uint64_t usec)
+{
+	time_t t = usec / 1000000;
+	char buffer[64];
+
+	if (!usec) {
+		printf("%-20s never\n", label);
+		return;
+	}
+	strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	printf("%-20s %s\n", label, buffer);
+}
+
+static void print_version(const char *label, uint32_t version)
+{
+	if (version) {
+		printf("%-20s %" PRIu32 "\n", label, version);
+	} else {
+		printf("%-20s none\n", label);
+	}
+}
+
+int status_main(int argc, char **argv)
+{
+	status_page_t state;
+	bool running;
+	int opt;
+	int r;
+
+	while ((opt = getopt_long(argc, argv, "h", prog_opts, NULL)) != -1) {
+		switch (opt) {
+		case 'h':
+			print_help(argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			print_help(argv[0]);
+			return -1;
+		}
+	}
+
+	r = status_page_read(STATUS_PAGE_PATH, &state);
+	if (r < 0) {
+		fprintf(stderr, "Can't read %s: %s\n", STATUS_PAGE_PATH,
+			r == -ENOENT ? "the daemon hasn't run yet" : strerror(-r));
+		return -1;
+	}
+
+	/* the daemon exits when idle, which leaves its last state behind */
+	running = state.pid && (kill(state.pid, 0) == 0 || errno == EPERM);
+	if (running) {
+		printf("%-20s running (pid %" PRIu32 ")\n", "Daemon:", state.pid);
+	} else {
+		printf("%-20s not running\n", "Daemon:");
+	}
+	print_time("Updated:", state.updated);
+
+	if (running && state.job_id) {
+		printf("%-20s %" PRIu64 " %s", "Current job:", state.job_id, state.method);
+		if (strcmp(state.phase, "none") != 0) {
+			printf(" (%s, %" PRIu32 "%%)", state.phase, state.percent);
+		}
+		printf("\n");
+		printf("%-20s %" PRIu32 " running, %" PRIu32 " queued\n", "Jobs:",
+		       state.running, state.queued);
+	} else {
+		printf("%-20s none\n", "Current job:");
+	}
+	if (state.last_method[0]) {
+		printf("%-20s %s exited with %" PRId32 "\n", "Last job:",
+		       state.last_method, state.last_status);
+		print_time("Last job finished:", state.last_completed);
+	}
+
+	print_version("Installed version:", state.installed_version);
+	print_version("Available version:", state.available_version);
+	print_version("Staged version:", state.staged_version);
+	if (state.check_time) {
+		printf("%-20s %" PRId32 "\n", "Last check result:", state.check_status);
+	}
+	print_time("Last check:", state.check_time);
+	print_time("Last update:", state.update_time);
+
+	return 0;
+}
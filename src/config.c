@@ -0,0 +1,396 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "log.h"
+
+typedef enum {
+	CONFIG_UINT,
+	CONFIG_BOOL,
+	CONFIG_STRING,
+	/* uint64_t in the range of cgroup weights */
+	CONFIG_WEIGHT,
+	/* uint64_t number of bytes with an optional K, M or G suffix */
+	CONFIG_SIZE,
+	/* unsigned int number of seconds with an optional s, m, h or d
+	 * suffix */
+	CONFIG_DURATION,
+	CONFIG_NICE,
+	CONFIG_IO_CLASS,
+	CONFIG_IDLE_MODE
+} config_type_t;
+
+struct config_key {
+	const char *name;
+	config_type_t type;
+	size_t offset;
+};
+
+static const struct config_key _config_keys[] = {
+	{ "max-queue-depth", CONFIG_UINT, offsetof(daemon_config_t, max_queue_depth) },
+	{ "max-running-jobs", CONFIG_UINT, offsetof(daemon_config_t, max_running_jobs) },
+	{ "bundle-batch-window", CONFIG_UINT, offsetof(daemon_config_t, bundle_batch_window) },
+	{ "resource-control", CONFIG_BOOL, offsetof(daemon_config_t, resource_control) },
+	{ "scope-slice", CONFIG_STRING, offsetof(daemon_config_t, scope_slice) },
+	{ "pressure-path", CONFIG_STRING, offsetof(daemon_config_t, pressure_path) },
+	{ "loadavg-path", CONFIG_STRING, offsetof(daemon_config_t, loadavg_path) },
+	{ "pressure-interval", CONFIG_UINT, offsetof(daemon_config_t, pressure_interval) },
+	{ "cpu-pressure-max", CONFIG_UINT, offsetof(daemon_config_t, pressure_limits.cpu) },
+	{ "io-pressure-max", CONFIG_UINT, offsetof(daemon_config_t, pressure_limits.io) },
+	{ "memory-pressure-max", CONFIG_UINT, offsetof(daemon_config_t, pressure_limits.memory) },
+	{ "load-max", CONFIG_UINT, offsetof(daemon_config_t, pressure_limits.load) },
+	{ "disk-free-min", CONFIG_SIZE, offsetof(daemon_config_t, pressure_limits.disk_free) },
+	{ "pressure-pause", CONFIG_BOOL, offsetof(daemon_config_t, pressure_pause) },
+	{ "pressure-hold-max", CONFIG_DURATION, offsetof(daemon_config_t, pressure_hold_max) },
+	{ "check-interval", CONFIG_DURATION, offsetof(daemon_config_t, schedule_interval[SCHEDULE_CHECK]) },
+	{ "download-interval", CONFIG_DURATION, offsetof(daemon_config_t, schedule_interval[SCHEDULE_DOWNLOAD]) },
+	{ "update-interval", CONFIG_DURATION, offsetof(daemon_config_t, schedule_interval[SCHEDULE_UPDATE]) },
+	{ "schedule-jitter", CONFIG_DURATION, offsetof(daemon_config_t, schedule_jitter) },
+	{ "maintenance-window", CONFIG_STRING, offsetof(daemon_config_t, maintenance_window) },
+	{ "machine-id-path", CONFIG_STRING, offsetof(daemon_config_t, machine_id_path) },
+	{ "predownload", CONFIG_BOOL, offsetof(daemon_config_t, predownload) },
+	{ "output-flush-size", CONFIG_SIZE, offsetof(daemon_config_t, output_flush_size) },
+	{ "output-flush-interval", CONFIG_UINT, offsetof(daemon_config_t, output_flush_interval) },
+	{ "output-flush-lines", CONFIG_BOOL, offsetof(daemon_config_t, output_flush_lines) },
+	{ "output-lines", CONFIG_BOOL, offsetof(daemon_config_t, output_lines) },
+	{ "output-history-size", CONFIG_SIZE, offsetof(daemon_config_t, output_history_size) },
+	{ "output-history-jobs", CONFIG_UINT, offsetof(daemon_config_t, output_history_jobs) },
+	{ "progress-interval", CONFIG_UINT, offsetof(daemon_config_t, progress_interval) },
+	{ "output-queue-max", CONFIG_UINT, offsetof(daemon_config_t, output_queue_max) },
+	{ "peer-socket", CONFIG_BOOL, offsetof(daemon_config_t, peer_socket) },
+	{ "peer-group", CONFIG_STRING, offsetof(daemon_config_t, peer_group) },
+	{ "idle-mode", CONFIG_IDLE_MODE, offsetof(daemon_config_t, idle_mode) },
+	{ "idle-timeout-min", CONFIG_DURATION, offsetof(daemon_config_t, idle_timeout_min) },
+	{ "idle-timeout-max", CONFIG_DURATION, offsetof(daemon_config_t, idle_timeout_max) },
+	{ NULL }
+};
+
+/* Keys allowed both globally and in method sections, the offsets are
+ * relative to scope_budget_t */
+static const struct config_key _budget_keys[] = {
+	{ "cpu-weight", CONFIG_WEIGHT, offsetof(scope_budget_t, cpu_weight) },
+	{ "io-weight", CONFIG_WEIGHT, offsetof(scope_budget_t, io_weight) },
+	{ "memory-high", CONFIG_SIZE, offsetof(scope_budget_t, memory_high) },
+	{ "nice", CONFIG_NICE, offsetof(scope_budget_t, nice) },
+	{ "io-class", CONFIG_IO_CLASS, offsetof(scope_budget_t, io_class) },
+	{ NULL }
+};
+
+void config_init(daemon_config_t *config)
+{
+	method_t method;
+
+	memset(config, 0x00, sizeof(daemon_config_t));
+	for (method = METHOD_NOTSET; method <= METHOD_SEARCH; method++) {
+		scope_budget_init(&config->budgets[method]);
+	}
+
+	config->max_queue_depth = 16;
+	config->bundle_batch_window = 250;
+	config->resource_control = true;
+	/* swupd yields to services under contention, but takes whatever
+	 * is left when the system is idle */
+	config->budgets[METHOD_NOTSET].cpu_weight = 50;
+	config->budgets[METHOD_NOTSET].io_weight = 50;
+	config->pressure_interval = 5000;
+	config->pressure_limits.cpu = 40;
+	config->pressure_limits.io = 40;
+	config->pressure_limits.memory = 20;
+	config->pressure_limits.disk_free = 256 * 1024 * 1024;
+	config->pressure_hold_max = 60 * 60;
+	config->schedule_jitter = 60 * 60;
+	config->output_flush_size = 16 * 1024;
+	config->output_flush_interval = 100;
+	config->output_flush_lines = true;
+	config->output_history_size = 64 * 1024;
+	config->output_history_jobs = 4;
+	config->progress_interval = 1000;
+	config->output_queue_max = 256;
+	config->peer_socket = true;
+	config->idle_mode = IDLE_MODE_ADAPTIVE;
+	config->idle_timeout_min = 30;
+	config->idle_timeout_max = 10 * 60;
+}
+
+void config_free(daemon_config_t *config)
+{
+	free(config->scope_slice);
+	config->scope_slice = NULL;
+	free(config->pressure_path);
+	config->pressure_path = NULL;
+	free(config->loadavg_path);
+	config->loadavg_path = NULL;
+	free(config->maintenance_window);
+	config->maintenance_window = NULL;
+	free(config->machine_id_path);
+	config->machine_id_path = NULL;
+	free(config->peer_group);
+	config->peer_group = NULL;
+}
+
+void config_get_budget(const daemon_config_t *config, method_t method, scope_budget_t *budget)
+{
+	*budget = config->budgets[method];
+	scope_budget_resolve(budget, &config->budgets[METHOD_NOTSET], true);
+}
+
+static const struct config_key *find_key(const struct config_key *keys, const char *name)
+{
+	for (; keys->name; keys++) {
+		if (strcmp(keys->name, name) == 0) {
+			return keys;
+		}
+	}
+
+	return NULL;
+}
+
+static char *strip(char *str)
+{
+	char *end;
+
+	while (isspace(*str)) {
+		str++;
+	}
+
+	end = str + strlen(str);
+	while (end > str && isspace(*(end - 1))) {
+		end--;
+	}
+	*end = '\0';
+
+	return str;
+}
+
+static int config_set_value(void *base,
+			    const struct config_key *key,
+			    const char *value)
+{
+	void *field = (char *)base + key->offset;
+	unsigned long long number;
+	long snumber;
+	char *endptr;
+
+	switch (key->type) {
+	case CONFIG_UINT:
+		errno = 0;
+		number = strtoul(value, &endptr, 10);
+		if (errno || *endptr != '\0' || endptr == value || number > UINT_MAX) {
+			return -EINVAL;
+		}
+		*(unsigned int *)field = number;
+		break;
+	case CONFIG_WEIGHT:
+		errno = 0;
+		number = strtoull(value, &endptr, 10);
+		if (errno || *endptr != '\0' || number < 1 || number > 10000) {
+			return -EINVAL;
+		}
+		*(uint64_t *)field = number;
+		break;
+	case CONFIG_SIZE:
+		errno = 0;
+		number = strtoull(value, &endptr, 10);
+		if (errno || endptr == value) {
+			return -EINVAL;
+		}
+		switch (*endptr) {
+		case 'G':
+			number *= 1024;
+			/* fall through */
+		case 'M':
+			number *= 1024;
+			/* fall through */
+		case 'K':
+			number *= 1024;
+			endptr++;
+			break;
+		}
+		if (*endptr != '\0') {
+			return -EINVAL;
+		}
+		*(uint64_t *)field = number;
+		break;
+	case CONFIG_DURATION:
+		errno = 0;
+		number = strtoull(value, &endptr, 10);
+		if (errno || endptr == value) {
+			return -EINVAL;
+		}
+		switch (*endptr) {
+		case 'd':
+			number *= 24;
+			/* fall through */
+		case 'h':
+			number *= 60;
+			/* fall through */
+		case 'm':
+			number *= 60;
+			/* fall through */
+		case 's':
+			endptr++;
+			break;
+		}
+		if (*endptr != '\0' || number > UINT_MAX) {
+			return -EINVAL;
+		}
+		*(unsigned int *)field = number;
+		break;
+	case CONFIG_NICE:
+		errno = 0;
+		snumber = strtol(value, &endptr, 10);
+		if (errno || *endptr != '\0' || endptr == value || snumber < -20 || snumber > 19) {
+			return -EINVAL;
+		}
+		*(int *)field = snumber;
+		break;
+	case CONFIG_IO_CLASS:
+		*(int *)field = scope_io_class_from_name(value);
+		if (!*(int *)field) {
+			return -EINVAL;
+		}
+		break;
+	case CONFIG_IDLE_MODE:
+		*(idle_mode_t *)field = idle_mode_from_name(value);
+		if (!*(idle_mode_t *)field) {
+			return -EINVAL;
+		}
+		break;
+	case CONFIG_BOOL:
+		if (strcmp(value, "true") == 0 || strcmp(value, "yes") == 0 ||
+		    strcmp(value, "1") == 0) {
+			*(bool *)field = true;
+		} else if (strcmp(value, "false") == 0 || strcmp(value, "no") == 0 ||
+			   strcmp(value, "0") == 0) {
+			*(bool *)field = false;
+		} else {
+			return -EINVAL;
+		}
+		break;
+	case CONFIG_STRING:
+		free(*(char **)field);
+		*(char **)field = strdup(value);
+		if (!*(char **)field) {
+			return -ENOMEM;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+int config_load(daemon_config_t *config, const char *path)
+{
+	FILE *file;
+	char *line = NULL;
+	size_t len = 0;
+	unsigned int lineno = 0;
+	/* method of the current section, METHOD_NOTSET for global keys */
+	method_t section = METHOD_NOTSET;
+	bool skip_section = false;
+	int r = 0;
+
+	file = fopen(path, "re");
+	if (!file) {
+		if (errno == ENOENT) {
+			return 0;
+		}
+		ERR("Can't open config file %s: %s", path, strerror(errno));
+		return -errno;
+	}
+
+	while (getline(&line, &len, file) > 0) {
+		const struct config_key *key;
+		void *base;
+		char *name;
+		char *value;
+		char *sep;
+
+		lineno++;
+		name = strip(line);
+		if (*name == '\0' || *name == '#') {
+			continue;
+		}
+
+		if (*name == '[') {
+			sep = strchr(name, ']');
+			if (!sep || sep[1] != '\0') {
+				ERR("%s:%u: missing ']'", path, lineno);
+				skip_section = true;
+				continue;
+			}
+			*sep = '\0';
+			section = job_method_from_name(name + 1);
+			skip_section = (section == METHOD_NOTSET);
+			if (skip_section) {
+				ERR("%s:%u: unknown section '%s'", path, lineno, name + 1);
+			}
+			continue;
+		}
+		if (skip_section) {
+			continue;
+		}
+
+		sep = strchr(name, '=');
+		if (!sep) {
+			ERR("%s:%u: missing '='", path, lineno);
+			continue;
+		}
+		*sep = '\0';
+		name = strip(name);
+		value = strip(sep + 1);
+
+		base = &config->budgets[section];
+		key = find_key(_budget_keys, name);
+		if (!key && section == METHOD_NOTSET) {
+			base = config;
+			key = find_key(_config_keys, name);
+		}
+		if (!key) {
+			ERR("%s:%u: unknown key '%s'", path, lineno, name);
+			continue;
+		}
+
+		r = config_set_value(base, key, value);
+		if (r == -ENOMEM) {
+			break;
+		} else if (r < 0) {
+			ERR("%s:%u: invalid value '%s' for '%s'", path, lineno, value, name);
+			r = 0;
+		}
+	}
+
+	free(line);
+	fclose(file);
+	return r;
+}
@@ -0,0 +1,122 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+
+#include "job.h"
+#include "scope.h"
+#include "pressure.h"
+#include "schedule.h"
+#include "idle.h"
+
+#define SWUPDD_CONFIG_FILE SYSCONFDIR "/swupdd.conf"
+
+typedef struct _daemon_config {
+	/* Maximum number of requests waiting for their turn */
+	unsigned int max_queue_depth;
+	/* Maximum number of swupd processes running in parallel,
+	 * 0 stands for the number of online CPUs */
+	unsigned int max_running_jobs;
+	/* Milliseconds bundle requests wait for compatible ones to be
+	 * merged with */
+	unsigned int bundle_batch_window;
+	/* Run swupd children in transient systemd scopes */
+	bool resource_control;
+	/* Slice the scopes are put into, NULL for systemd's default */
+	char *scope_slice;
+	/* Resource budgets indexed by method_t, the one of METHOD_NOTSET
+	 * applies to all methods. Set in [<method>] sections. */
+	scope_budget_t budgets[METHOD_SEARCH + 1];
+	/* Directory of the PSI files and path of the load average file,
+	 * NULL for the ones of /proc */
+	char *pressure_path;
+	char *loadavg_path;
+	/* Milliseconds between samples of the host's load while there are
+	 * background jobs, 0 disables admission control */
+	unsigned int pressure_interval;
+	/* Background jobs wait while any of the limits is exceeded */
+	pressure_limits_t pressure_limits;
+	/* Pause running background jobs as well */
+	bool pressure_pause;
+	/* Seconds background jobs are held at most, 0 holds them as long as
+	 * the host is busy */
+	unsigned int pressure_hold_max;
+	/* Seconds between scheduled runs of CheckUpdate, Update with
+	 * --download and Update, 0 disables them */
+	unsigned int schedule_interval[SCHEDULE_MAX];
+	/* Seconds scheduled runs are spread over across machines */
+	unsigned int schedule_jitter;
+	/* "HH:MM-HH:MM" of local time scheduled runs are restricted to */
+	char *maintenance_window;
+	/* File the machine's offsets in the schedule are derived from */
+	char *machine_id_path;
+	/* Download the content of a new version found by CheckUpdate */
+	bool predownload;
+	/* Child output is forwarded once this many bytes accumulated, */
+	uint64_t output_flush_size;
+	/* or after it waited this many milliseconds. 0 forwards output as
+	 * soon as it is read. */
+	unsigned int output_flush_interval;
+	/* Forward complete lines only, unless output waited for too long */
+	bool output_flush_lines;
+	/* Forward output as arrays of complete lines in ChildOutputLines
+	 * instead of ChildOutputReceived */
+	bool output_lines;
+	/* Bytes of output kept per job for GetJobOutput */
+	uint64_t output_history_size;
+	/* Finished jobs the output is kept for */
+	unsigned int output_history_jobs;
+	/* Milliseconds between Progress signals of a job unless its phase
+	 * changes, 0 disables them */
+	unsigned int progress_interval;
+	/* Child output is no longer read while this many messages wait to be
+	 * written to the bus, until half of them are. 0 disables the limit. */
+	unsigned int output_queue_max;
+	/* Listen for direct connections of local clients on PEER_SOCKET_PATH */
+	bool peer_socket;
+	/* Group whose members besides root may connect directly, NULL lets
+	 * everyone in */
+	char *peer_group;
+	/* When the daemon exits while idle */
+	idle_mode_t idle_mode;
+	/* Seconds the adaptive mode waits for requests at least and at
+	 * most */
+	unsigned int idle_timeout_min;
+	unsigned int idle_timeout_max;
+} daemon_config_t;
+
+/* Fills in the built-in defaults */
+void config_init(daemon_config_t *config);
+
+void config_free(daemon_config_t *config);
+
+/* Overrides the defaults with "key = value" lines read from the file at
+ * path. A missing file is not an error. */
+int config_load(daemon_config_t *config, const char *path);
+
+/* Returns the budget configured for the method, with the settings common
+ * to all methods filled in */
+void config_get_budget(const daemon_config_t *config, method_t method, scope_budget_t *budget);
+
+#endif /* CONFIG_H */
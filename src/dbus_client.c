@@ -20,6 +20,9 @@
  */
 
 #include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #include <systemd/sd-bus.h>
 #include <systemd/sd-event.h>
@@ -27,6 +30,7 @@
 #include "dbus_client.h"
 #include "option.h"
 #include "log.h"
+#include "peer.h"
 
 typedef struct _command_ctx {
 	sd_bus *bus;
@@ -51,19 +55,118 @@ static int on_child_output_received(sd_bus_message *message, void *userdata, sd_
 	return 0;
 }
 
-static int on_request_completed(sd_bus_message *message, void *userdata, sd_bus_error *error)
+static int on_child_error_received(sd_bus_message *message, void *userdata, sd_bus_error *error)
 {
-	sd_event *event = userdata;
-	const char *method;
+	const char *output;
+	int r;
+
+	r  = sd_bus_message_read(message, "s", &output);
+	if (r < 0) {
+		ERR("Can't read client's errors: %s", strerror(-r));
+		return -1;
+	}
+	/* keep the order of stdout written so far */
+	fflush(stdout);
+	fprintf(stderr, "%s", output);
+
+	return 0;
+}
+
+/* lines written with a single writev(), each one takes two vectors */
+#define OUTPUT_LINES_BATCH 64
+
+static int write_all(int fd, struct iovec *iov, int count)
+{
+	ssize_t written;
+
+	while (count > 0) {
+		written = writev(fd, iov, count);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -errno;
+		}
+		/* skip what has been written and resume in the middle of a
+		 * partially written vector */
+		while (count > 0 && (size_t) written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return 0;
+}
+
+static int on_child_output_lines(sd_bus_message *message, void *userdata, sd_bus_error *error)
+{
+	struct iovec iov[OUTPUT_LINES_BATCH * 2];
+	const char *line;
+	int count = 0;
+	int r;
+
+	r = sd_bus_message_enter_container(message, SD_BUS_TYPE_ARRAY, "s");
+	if (r < 0) {
+		ERR("Can't read client's output: %s", strerror(-r));
+		return -1;
+	}
+
+	/* whatever printf() has buffered goes first */
+	fflush(stdout);
+	while ((r = sd_bus_message_read_basic(message, SD_BUS_TYPE_STRING, &line)) > 0) {
+		iov[count].iov_base = (char *) line;
+		iov[count].iov_len = strlen(line);
+		iov[count + 1].iov_base = "\n";
+		iov[count + 1].iov_len = 1;
+		count += 2;
+		if (count == OUTPUT_LINES_BATCH * 2) {
+			r = write_all(STDOUT_FILENO, iov, count);
+			if (r < 0) {
+				break;
+			}
+			count = 0;
+		}
+	}
+	if (r >= 0 && count) {
+		r = write_all(STDOUT_FILENO, iov, count);
+	}
+	if (r < 0) {
+		ERR("Can't print client's output: %s", strerror(-r));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* The request waits for its job, so the reply carries the outcome */
+static int on_method_reply(sd_bus_message *message, void *userdata, sd_bus_error *error)
+{
+	sd_event *event = sd_bus_get_event(sd_bus_message_get_bus(message));
+	const sd_bus_error *reply_error = sd_bus_message_get_error(message);
+	const char *job_path;
 	int code;
 	int r;
 
-	r  = sd_bus_message_read(message, "si", &method, &code);
+	if (reply_error) {
+		ERR("Failed to make D-Bus call: %s (%s)",
+		    strerror(sd_bus_error_get_errno(reply_error)),
+		    reply_error->message);
+		code = 1;
+		goto finish;
+	}
+
+	r = sd_bus_message_read(message, "oi", &job_path, &code);
 	if (r < 0) {
 		ERR("Can't read request results: %s", strerror(-r));
 		abort();
 	}
 
+finish:
 	r = sd_event_exit(event, code);
 	if (r < 0) {
 		ERR("Can't exit event loop: %s", strerror(-r));
@@ -77,10 +180,8 @@ static int on_run_command(sd_event_source *s, void *userdata)
 {
 	command_ctx_t *ctx = userdata;
 	struct list *opts = list_head(ctx->opts);
-	sd_bus_error error = SD_BUS_ERROR_NULL;
-	sd_bus_message *reply = NULL;
 	sd_bus_message *m = NULL;
-	int return_value = 0;
+	int wait = 1;
 	int r;
 
 	r = sd_bus_message_new_method_call(ctx->bus, &m,
@@ -126,6 +227,12 @@ static int on_run_command(sd_event_source *s, void *userdata)
 		}
 		opts = opts->next;
 	}
+	/* no need to catch RequestCompleted, which might race a short job */
+	r = sd_bus_message_append(m, "{sv}", "wait", "b", wait);
+	if (r < 0) {
+		ERR("Failed to append option: %s", strerror(-r));
+		goto finish;
+	}
 	r = sd_bus_message_close_container(m); /* SD_BUS_TYPE_ARRAY */
 	if (r < 0) {
 		ERR("Failed to close array container: %s", strerror(-r));
@@ -146,29 +253,15 @@ static int on_run_command(sd_event_source *s, void *userdata)
 		}
 	}
 
-	r = sd_bus_call(ctx->bus, m, 0, &error, &reply);
+	/* jobs may wait in the queue and run for long */
+	r = sd_bus_call_async(ctx->bus, NULL, m, on_method_reply, NULL, UINT64_MAX);
 	if (r < 0) {
-		ERR("Failed to make D-Bus call: %s (%s)",
-		    strerror(sd_bus_error_get_errno(&error)),
-		    error.message);
+		ERR("Failed to make D-Bus call: %s", strerror(-r));
 		goto finish;
 	}
 
-	/* TODO: do we really need return_value? */
-	r = sd_bus_message_read(reply, "b", &return_value);
-	if (r < 0) {
-		ERR("Failed to parse response message: %s", strerror(-r));
-		goto finish;
-	}
-
-	if (!return_value) {
-		ERR("Hm... something's wrong if there's no D-Bus error set");
-	}
-
 finish:
-	sd_bus_message_unref(reply);
 	sd_bus_message_unref(m);
-	sd_bus_error_free(&error);
 	if (r < 0) {
 		sd_event *event;
 		r = sd_event_default(&event);
@@ -225,6 +318,38 @@ finish:
 	return 0;
 }
 
+/* Talks to the daemon over its direct socket if it listens on it, and
+ * over the system bus otherwise */
+static int open_daemon_bus(sd_bus **ret)
+{
+	sd_bus_error error = SD_BUS_ERROR_NULL;
+	sd_bus *bus = NULL;
+	int r;
+
+	r = sd_bus_new(&bus);
+	if (r >= 0) {
+		r = sd_bus_set_address(bus, "unix:path=" PEER_SOCKET_PATH);
+	}
+	if (r >= 0) {
+		r = sd_bus_start(bus);
+	}
+	/* the daemon may still refuse the connection once accepted */
+	if (r >= 0) {
+		r = sd_bus_call_method(bus, NULL, "/org/O1/swupdd/Client", "org.freedesktop.DBus.Peer",
+				       "Ping", &error, NULL, "");
+	}
+	sd_bus_error_free(&error);
+	if (r >= 0) {
+		*ret = bus;
+		return 0;
+	}
+	sd_bus_unref(bus);
+
+	/* swupdctl's stdout is the output of swupd, so the fallback is
+	 * silent */
+	return sd_bus_open_system(ret);
+}
+
 int dbus_client_call_method(const char *const method, struct list *opts, dbus_cmd_argv_type argv_type,
 			    char *argv[])
 {
@@ -254,7 +379,7 @@ int dbus_client_call_method(const char *const method, struct list *opts, dbus_cm
 		goto finish;
 	}
 
-	r = sd_bus_open_system(&bus);
+	r = open_daemon_bus(&bus);
 	if (r < 0) {
 		ERR("Failed to connect to system bus: %s", strerror(-r));
 		goto finish;
@@ -287,12 +412,24 @@ int dbus_client_call_method(const char *const method, struct list *opts, dbus_cm
 			     NULL, /* bus slot */
 			     "type='signal',"
 			     "interface='org.O1.swupdd.Client',"
-			     "member='RequestCompleted',"
+			     "member='ChildErrorReceived',"
 			     "path='/org/O1/swupdd/Client'",
-			     on_request_completed,
-			     event /* user data */);
+			     on_child_error_received,
+			     NULL /* user data */);
 	if (r < 0) {
-		ERR("Failed to add handler for ChildOutputReceived signal: %s", strerror(-r));
+		ERR("Failed to add handler for ChildErrorReceived signal: %s", strerror(-r));
+		goto finish;
+	}
+	r = sd_bus_add_match(bus,
+			     NULL, /* bus slot */
+			     "type='signal',"
+			     "interface='org.O1.swupdd.Client',"
+			     "member='ChildOutputLines',"
+			     "path='/org/O1/swupdd/Client'",
+			     on_child_output_lines,
+			     NULL /* user data */);
+	if (r < 0) {
+		ERR("Failed to add handler for ChildOutputLines signal: %s", strerror(-r));
 		goto finish;
 	}
 
@@ -0,0 +1,323 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <regex.h>
+
+#include "filter.h"
+
+/* Node of the Aho-Corasick automaton the fixed strings are matched with,
+ * so that a line is scanned once no matter how many strings there are */
+typedef struct _ac_node {
+	int first_child;
+	int next_sibling;
+	/* longest proper suffix of the node's string that is also a prefix
+	 * of one of the strings */
+	int fail;
+	unsigned char byte;
+	/* a string ends here or at one of the fail nodes */
+	bool match;
+} ac_node_t;
+
+struct _filter {
+	ac_node_t *nodes;
+	int n_nodes;
+	/* fail links are computed before the first match */
+	bool compiled;
+	regex_t regex;
+	bool has_regex;
+	filter_severity_t severity;
+	/* partial line held back from the previous chunk */
+	char *partial;
+	size_t partial_len;
+};
+
+filter_t *filter_new(void)
+{
+	filter_t *filter = calloc(1, sizeof(filter_t));
+
+	if (!filter) {
+		return NULL;
+	}
+	filter->nodes = calloc(1, sizeof(ac_node_t));
+	if (!filter->nodes) {
+		free(filter);
+		return NULL;
+	}
+	filter->nodes[0].first_child = -1;
+	filter->nodes[0].next_sibling = -1;
+	filter->n_nodes = 1;
+
+	return filter;
+}
+
+void filter_free(void *data)
+{
+	filter_t *filter = data;
+
+	if (!filter) {
+		return;
+	}
+	if (filter->has_regex) {
+		regfree(&filter->regex);
+	}
+	free(filter->nodes);
+	free(filter->partial);
+	free(filter);
+}
+
+static int ac_child(const filter_t *filter, int node, unsigned char byte)
+{
+	int child;
+
+	for (child = filter->nodes[node].first_child; child >= 0;
+	     child = filter->nodes[child].next_sibling) {
+		if (filter->nodes[child].byte == byte) {
+			return child;
+		}
+	}
+
+	return -1;
+}
+
+int filter_add_string(filter_t *filter, const char *str)
+{
+	int node = 0;
+	int child;
+	ac_node_t *nodes;
+
+	if (!*str) {
+		return -EINVAL;
+	}
+
+	for (; *str; str++) {
+		child = ac_child(filter, node, *str);
+		if (child < 0) {
+			nodes = realloc(filter->nodes, (filter->n_nodes + 1) * sizeof(ac_node_t));
+			if (!nodes) {
+				return -ENOMEM;
+			}
+			filter->nodes = nodes;
+			child = filter->n_nodes++;
+			nodes[child].first_child = -1;
+			nodes[child].next_sibling = nodes[node].first_child;
+			nodes[child].fail = 0;
+			nodes[child].byte = *str;
+			nodes[child].match = false;
+			nodes[node].first_child = child;
+		}
+		node = child;
+	}
+	filter->nodes[node].match = true;
+	filter->compiled = false;
+
+	return 0;
+}
+
+/* Computes the fail links breadth first, so that the ones of shorter
+ * strings are known when they are needed */
+static int ac_compile(filter_t *filter)
+{
+	ac_node_t *nodes = filter->nodes;
+	int *queue;
+	int head = 0;
+	int tail = 0;
+	int node;
+	int child;
+	int fail;
+
+	queue = malloc(filter->n_nodes * sizeof(int));
+	if (!queue) {
+		return -ENOMEM;
+	}
+
+	for (child = nodes[0].first_child; child >= 0; child = nodes[child].next_sibling) {
+		nodes[child].fail = 0;
+		queue[tail++] = child;
+	}
+	while (head < tail) {
+		node = queue[head++];
+		for (child = nodes[node].first_child; child >= 0; child = nodes[child].next_sibling) {
+			fail = nodes[node].fail;
+			while (fail && ac_child(filter, fail, nodes[child].byte) < 0) {
+				fail = nodes[fail].fail;
+			}
+			fail = ac_child(filter, fail, nodes[child].byte);
+			nodes[child].fail = (fail >= 0 && fail != child) ? fail : 0;
+			nodes[child].match |= nodes[nodes[child].fail].match;
+			queue[tail++] = child;
+		}
+	}
+
+	free(queue);
+	filter->compiled = true;
+
+	return 0;
+}
+
+static bool ac_match(const filter_t *filter, const char *line, size_t len)
+{
+	int node = 0;
+	int child;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		while ((child = ac_child(filter, node, line[i])) < 0 && node) {
+			node = filter->nodes[node].fail;
+		}
+		node = child >= 0 ? child : 0;
+		if (filter->nodes[node].match) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int filter_set_regex(filter_t *filter, const char *pattern)
+{
+	if (filter->has_regex) {
+		regfree(&filter->regex);
+		filter->has_regex = false;
+	}
+	if (regcomp(&filter->regex, pattern, REG_EXTENDED | REG_NOSUB) != 0) {
+		return -EINVAL;
+	}
+	filter->has_regex = true;
+
+	return 0;
+}
+
+void filter_set_severity(filter_t *filter, filter_severity_t severity)
+{
+	filter->severity = severity;
+}
+
+filter_severity_t filter_severity_from_name(const char *name)
+{
+	if (strcmp(name, "error") == 0) {
+		return FILTER_SEVERITY_ERROR;
+	} else if (strcmp(name, "warning") == 0) {
+		return FILTER_SEVERITY_WARNING;
+	}
+
+	return FILTER_SEVERITY_NONE;
+}
+
+static bool contains_nocase(const char *line, const char *word)
+{
+	return strcasestr(line, word) != NULL;
+}
+
+/* swupd has no structured severities, its messages are told apart by the
+ * words they use */
+static filter_severity_t line_severity(const char *line, bool errors)
+{
+	if (errors || contains_nocase(line, "error") || contains_nocase(line, "fail")) {
+		return FILTER_SEVERITY_ERROR;
+	} else if (contains_nocase(line, "warning")) {
+		return FILTER_SEVERITY_WARNING;
+	}
+
+	return FILTER_SEVERITY_NONE;
+}
+
+/* The line is NUL terminated in place of its newline */
+static bool filter_passes(const filter_t *filter, const char *line, size_t len, bool errors)
+{
+	if (filter->n_nodes > 1 && ac_match(filter, line, len)) {
+		return true;
+	}
+	if (filter->has_regex && regexec(&filter->regex, line, 0, NULL, 0) == 0) {
+		return true;
+	}
+	if (filter->severity && line_severity(line, errors) >= filter->severity) {
+		return true;
+	}
+
+	return false;
+}
+
+char *filter_apply(filter_t *filter, const char *text, size_t len, bool errors, bool last,
+		   size_t *out_len)
+{
+	char *buffer;
+	char *out;
+	char *line;
+	char *end;
+	size_t total = filter->partial_len + len;
+	size_t line_len;
+
+	*out_len = 0;
+	if (!filter->compiled && ac_compile(filter) < 0) {
+		return NULL;
+	}
+
+	/* lines passing are copied over the ones checked already, the
+	 * buffer has room for a newline added to the last one and a NUL */
+	buffer = malloc(total + 2);
+	if (!buffer) {
+		return NULL;
+	}
+	memcpy(buffer, filter->partial, filter->partial_len);
+	memcpy(buffer + filter->partial_len, text, len);
+	buffer[total] = '\0';
+	free(filter->partial);
+	filter->partial = NULL;
+	filter->partial_len = 0;
+
+	out = buffer;
+	for (line = buffer; line < buffer + total; line = end + 1) {
+		end = memchr(line, '\n', buffer + total - line);
+		if (!end) {
+			if (!last) {
+				filter->partial_len = buffer + total - line;
+				filter->partial = strndup(line, filter->partial_len);
+				if (!filter->partial) {
+					filter->partial_len = 0;
+				}
+				break;
+			}
+			end = buffer + total;
+		}
+		line_len = end - line;
+		*end = '\0';
+		if (filter_passes(filter, line, line_len, errors)) {
+			memmove(out, line, line_len);
+			out[line_len] = '\n';
+			out += line_len + 1;
+		}
+	}
+
+	*out_len = out - buffer;
+	if (!*out_len) {
+		free(buffer);
+		return NULL;
+	}
+	*out = '\0';
+
+	return buffer;
+}
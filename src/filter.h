@@ -0,0 +1,56 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+	FILTER_SEVERITY_NONE = 0,
+	FILTER_SEVERITY_WARNING,
+	FILTER_SEVERITY_ERROR
+} filter_severity_t;
+
+typedef struct _filter filter_t;
+
+/* A filter passes lines containing any of its fixed strings, matching its
+ * regular expression or of its severity or above. An empty filter passes
+ * nothing. */
+filter_t *filter_new(void);
+void filter_free(void *data);
+
+int filter_add_string(filter_t *filter, const char *str);
+/* POSIX extended regular expression */
+int filter_set_regex(filter_t *filter, const char *pattern);
+void filter_set_severity(filter_t *filter, filter_severity_t severity);
+/* Returns FILTER_SEVERITY_NONE for unknown names */
+filter_severity_t filter_severity_from_name(const char *name);
+
+/* Returns the lines of a chunk of output the filter passes, each one with
+ * its newline, or NULL if there are none. A partial line at the end of the
+ * chunk is held back until the rest of it comes, unless last is set.
+ * Errors are lines from stderr, they are always of error severity. */
+char *filter_apply(filter_t *filter, const char *text, size_t len, bool errors, bool last,
+		   size_t *out_len);
+
+#endif /* FILTER_H */
@@ -0,0 +1,120 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "idle.h"
+#include "statefile.h"
+#include "log.h"
+
+static const char * const _mode_names[] = {
+	[IDLE_MODE_NOTSET] = NULL,
+	[IDLE_MODE_ADAPTIVE] = "adaptive",
+	[IDLE_MODE_RESIDENT] = "resident",
+	[IDLE_MODE_EAGER] = "eager",
+};
+
+const char *idle_mode_name(idle_mode_t mode)
+{
+	return _mode_names[mode];
+}
+
+idle_mode_t idle_mode_from_name(const char *name)
+{
+	idle_mode_t mode;
+
+	for (mode = IDLE_MODE_ADAPTIVE; mode <= IDLE_MODE_EAGER; mode++) {
+		if (strcmp(_mode_names[mode], name) == 0) {
+			return mode;
+		}
+	}
+
+	return IDLE_MODE_NOTSET;
+}
+
+void idle_note_request(idle_t *idle, uint64_t now)
+{
+	uint64_t gap;
+
+	if (idle->last_request && now > idle->last_request + IDLE_BURST_USEC) {
+		gap = now - idle->last_request;
+		/* recent gaps weigh more, a quarter each */
+		idle->gap_usec = idle->gap_usec ? (3 * idle->gap_usec + gap) / 4 : gap;
+	}
+	idle->last_request = now;
+}
+
+uint64_t idle_timeout(const idle_t *idle)
+{
+	switch (idle->mode) {
+	case IDLE_MODE_RESIDENT:
+		return UINT64_MAX;
+	case IDLE_MODE_EAGER:
+		return IDLE_EAGER_USEC;
+	default:
+		break;
+	}
+
+	if (!idle->gap_usec || 2 * idle->gap_usec > idle->max_usec) {
+		return idle->min_usec;
+	}
+
+	return 2 * idle->gap_usec > idle->min_usec ? 2 * idle->gap_usec : idle->min_usec;
+}
+
+int idle_load(idle_t *idle, const char *path)
+{
+	FILE *file;
+
+	file = fopen(path, "re");
+	if (!file) {
+		return errno == ENOENT ? 0 : -errno;
+	}
+	if (fscanf(file, "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+		   &idle->gap_usec, &idle->last_request,
+		   &idle->activations, &idle->startup_usec) != 4) {
+		idle->gap_usec = 0;
+		idle->last_request = 0;
+		idle->activations = 0;
+		idle->startup_usec = 0;
+	}
+	fclose(file);
+
+	return 0;
+}
+
+int idle_save(const idle_t *idle, const char *path)
+{
+	int r;
+
+	r = statefile_write(path, "%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+			    idle->gap_usec, idle->last_request, idle->activations, idle->startup_usec);
+	if (r < 0) {
+		ERR("Can't save idle state to %s: %s", path, strerror(-r));
+	}
+	return r;
+}
@@ -0,0 +1,78 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdint.h>
+
+#define IDLE_STATE_FILE LOCALSTATEDIR "/lib/swupdd/idle"
+
+typedef enum {
+	IDLE_MODE_NOTSET = 0,
+	/* stay up as long as the next request is expected to come soon */
+	IDLE_MODE_ADAPTIVE,
+	/* never exit */
+	IDLE_MODE_RESIDENT,
+	/* exit as soon as there is nothing to do */
+	IDLE_MODE_EAGER
+} idle_mode_t;
+
+/* Requests coming closer to each other than this belong to one burst,
+ * the daemon stays up for them anyway */
+#define IDLE_BURST_USEC (1000 * 1000ULL)
+/* Grace of the eager mode for requests already on their way */
+#define IDLE_EAGER_USEC (1000 * 1000ULL)
+
+typedef struct _idle {
+	idle_mode_t mode;
+	/* bounds of the adaptive timeout */
+	uint64_t min_usec;
+	uint64_t max_usec;
+	/* moving average of the gaps between bursts of requests, 0 until a
+	 * gap has been seen */
+	uint64_t gap_usec;
+	/* CLOCK_REALTIME time of the last request, the gaps span restarts */
+	uint64_t last_request;
+	/* starts of the daemon and the time they took altogether */
+	uint64_t activations;
+	uint64_t startup_usec;
+} idle_t;
+
+const char *idle_mode_name(idle_mode_t mode);
+/* Returns IDLE_MODE_NOTSET for unknown names */
+idle_mode_t idle_mode_from_name(const char *name);
+
+/* Accounts for a request arriving at now */
+void idle_note_request(idle_t *idle, uint64_t now);
+
+/* Returns how long the daemon waits for requests before it exits, or
+ * UINT64_MAX if it stays. The adaptive timeout covers twice the average
+ * gap, unless that's beyond the upper bound: the daemon is then better off
+ * exiting early and being started again. */
+uint64_t idle_timeout(const idle_t *idle);
+
+/* The history outlives the daemon exiting when idle, the mode and bounds
+ * come from the configuration */
+int idle_load(idle_t *idle, const char *path);
+int idle_save(const idle_t *idle, const char *path);
+
+#endif /* IDLE_H */
@@ -0,0 +1,712 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "job.h"
+
+#define SWUPD_DEFAULT_PATH "/"
+
+/* Method pairs not allowed to share a state directory or path, indexed by
+ * method_t. Reading methods get along with each other and with updates
+ * which replace files atomically, but verifying a tree being modified
+ * would report bogus mismatches. */
+static const bool _method_conflicts[][METHOD_SEARCH + 1] = {
+	/* columns:               -      CU     UP     VE     BA     BR     HD     SE */
+	[METHOD_CHECK_UPDATE]  = { false, false, false, false, false, false, false, false },
+	[METHOD_UPDATE]        = { false, false, true,  true,  true,  true,  false, false },
+	[METHOD_VERIFY]        = { false, false, true,  false, true,  true,  false, false },
+	[METHOD_BUNDLE_ADD]    = { false, false, true,  true,  true,  true,  false, false },
+	[METHOD_BUNDLE_REMOVE] = { false, false, true,  true,  true,  true,  false, false },
+	[METHOD_HASH_DUMP]     = { false, false, false, false, false, false, false, false },
+	[METHOD_SEARCH]        = { false, false, false, false, false, false, false, false },
+};
+
+static const char * const _method_str_map[] = {
+	NULL,
+	"CheckUpdate",
+	"Update",
+	"Verify",
+	"BundleAdd",
+	"BundleRemove",
+	"HashDump",
+	"Search"
+};
+
+typedef struct _job_share {
+	uid_t uid;
+	unsigned int served;
+} job_share_t;
+
+const char *job_method_name(method_t method)
+{
+	return _method_str_map[method];
+}
+
+method_t job_method_from_name(const char *name)
+{
+	method_t method;
+
+	for (method = METHOD_CHECK_UPDATE; method <= METHOD_SEARCH; method++) {
+		if (strcmp(_method_str_map[method], name) == 0) {
+			return method;
+		}
+	}
+
+	return METHOD_NOTSET;
+}
+
+static void free_job_caller(void *data)
+{
+	job_caller_t *caller = data;
+
+	list_free_list_and_data(caller->bundles, free);
+	filter_free(caller->filter);
+	sd_bus_message_unref(caller->request);
+	free(caller->name);
+	free(caller);
+}
+
+job_t *job_new(method_t method)
+{
+	job_t *job;
+
+	job = calloc(1, sizeof(job_t));
+	if (!job) {
+		return NULL;
+	}
+
+	job->method = method;
+	/* to be chosen when the request gets submitted */
+	job->priority = JOB_PRIORITY_MAX;
+	job->uid = (uid_t) -1;
+	job->gate_fd = -1;
+	job->pidfd = -1;
+	job->output_fd = -1;
+	job->error_fd = -1;
+	job->output_sink = -1;
+	job->streams = JOB_STREAM_ALL;
+	scope_budget_init(&job->budget);
+
+	return job;
+}
+
+void job_free(void *data)
+{
+	job_t *job = data;
+
+	if (!job) {
+		return;
+	}
+
+	list_free_list_and_data(job->args, free);
+	list_free_list_and_data(job->callers, free_job_caller);
+	free(job->canceller);
+	sd_bus_message_unref(job->canceller_request);
+	filter_free(job->filter);
+	list_free_list_and_data(job->bundles, free);
+	list_free_list_and_data(job->failed_bundles, free);
+	scope_request_free(job->scope_request);
+	free(job->scope);
+	free(job->output);
+	ring_free(&job->history);
+	/* lets a child still waiting for its scope exit */
+	if (job->gate_fd >= 0) {
+		close(job->gate_fd);
+	}
+	if (job->pidfd >= 0) {
+		close(job->pidfd);
+	}
+	if (job->output_sink >= 0) {
+		close(job->output_sink);
+	}
+	free(job);
+}
+
+job_caller_t *job_add_caller(job_t *job, const char *name, uid_t uid, struct list *bundles)
+{
+	job_caller_t *caller;
+
+	caller = calloc(1, sizeof(job_caller_t));
+	if (!caller) {
+		return NULL;
+	}
+	caller->name = strdup(name);
+	caller->uid = uid;
+	caller->bundles = list_head(bundles);
+	caller->streams = JOB_STREAM_ALL;
+
+	job->callers = list_head(list_append_data(job->callers, caller));
+
+	return caller;
+}
+
+job_caller_t *job_find_caller(job_t *job, const char *name)
+{
+	struct list *item;
+
+	if (!name) {
+		return NULL;
+	}
+
+	for (item = list_head(job->callers); item; item = item->next) {
+		job_caller_t *caller = item->data;
+
+		if (strcmp(caller->name, name) == 0) {
+			return caller;
+		}
+	}
+
+	return NULL;
+}
+
+void job_remove_caller(job_t *job, job_caller_t *caller)
+{
+	struct list *item = list_find_data(job->callers, caller);
+
+	if (item) {
+		job->callers = list_head(list_free_item(item, free_job_caller));
+	}
+}
+
+uint64_t job_get_paused_usec(job_t *job, uint64_t now)
+{
+	if (!job->paused) {
+		return job->paused_usec;
+	}
+
+	return job->paused_usec + now - job->paused_at;
+}
+
+bool job_has_arg(job_t *job, const char *arg)
+{
+	struct list *item = list_head(job->args);
+
+	while (item) {
+		if (strcmp(item->data, arg) == 0) {
+			return true;
+		}
+		item = item->next;
+	}
+
+	return false;
+}
+
+static bool string_in_list(struct list *strlist, const char *str)
+{
+	struct list *item;
+
+	for (item = list_head(strlist); item; item = item->next) {
+		if (strcmp(item->data, str) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void job_add_bundle_args(job_t *job)
+{
+	struct list *added = NULL;
+	struct list *item;
+
+	for (item = list_head(job->callers); item; item = item->next) {
+		job_caller_t *caller = item->data;
+		struct list *bundle;
+
+		for (bundle = list_head(caller->bundles); bundle; bundle = bundle->next) {
+			if (string_in_list(added, bundle->data)) {
+				continue;
+			}
+			added = list_append_data(added, bundle->data);
+			job->args = list_append_data(job->args, strdup(bundle->data));
+		}
+	}
+
+	list_free_list(added);
+}
+
+/* Returns true if line mentions bundle as a separate word */
+static bool line_names_bundle(const char *line, size_t len, const char *bundle)
+{
+	size_t bundle_len = strlen(bundle);
+	const char *pos = line;
+
+	while ((pos = memmem(pos, len - (pos - line), bundle, bundle_len))) {
+		bool starts = pos == line || !(isalnum(pos[-1]) || pos[-1] == '-' || pos[-1] == '_');
+		const char *end = pos + bundle_len;
+		bool ends = end == line + len || !(isalnum(*end) || *end == '-' || *end == '_');
+
+		if (starts && ends) {
+			return true;
+		}
+		pos++;
+	}
+
+	return false;
+}
+
+static bool line_reports_failure(const char *line, size_t len)
+{
+	char *copy = strndup(line, len);
+	bool failure;
+
+	if (!copy) {
+		return false;
+	}
+	failure = strcasestr(copy, "error") || strcasestr(copy, "fail") ||
+		  strstr(copy, "invalid") || strstr(copy, "not installed");
+	free(copy);
+
+	return failure;
+}
+
+void job_scan_bundle_output(job_t *job, const char *output)
+{
+	const char *line = output;
+
+	while (*line) {
+		const char *end = strchrnul(line, '\n');
+		size_t len = end - line;
+		struct list *item;
+
+		if (len && line_reports_failure(line, len)) {
+			for (item = list_head(job->callers); item; item = item->next) {
+				job_caller_t *caller = item->data;
+				struct list *bundle;
+
+				for (bundle = list_head(caller->bundles); bundle; bundle = bundle->next) {
+					if (line_names_bundle(line, len, bundle->data) &&
+					    !string_in_list(job->failed_bundles, bundle->data)) {
+						job->failed_bundles = list_head(list_append_data(job->failed_bundles,
+												 strdup(bundle->data)));
+					}
+				}
+			}
+		}
+
+		line = *end ? end + 1 : end;
+	}
+}
+
+char *job_output_reserve(job_t *job, size_t len)
+{
+	size_t size = job->output_size ? job->output_size : len + 1;
+	char *output;
+
+	while (size < job->output_len + len + 1) {
+		size *= 2;
+	}
+	if (size != job->output_size) {
+		output = realloc(job->output, size);
+		if (!output) {
+			return NULL;
+		}
+		job->output = output;
+		job->output_size = size;
+	}
+
+	return job->output + job->output_len;
+}
+
+/* Returns len shortened so that it doesn't split a multibyte character */
+static size_t utf8_boundary(const char *str, size_t len)
+{
+	size_t start;
+	size_t lead;
+
+	/* a character takes 4 bytes at most, look for the lead byte of the
+	 * last one */
+	for (start = len; start > 0 && len - start < 4; start--) {
+		unsigned char c = str[start - 1];
+
+		if ((c & 0xc0) == 0x80) {
+			continue;
+		}
+		if (c < 0x80) {
+			return len;
+		}
+
+		lead = start - 1;
+		if ((c & 0xe0) == 0xc0) {
+			return lead + 2 <= len ? len : lead;
+		} else if ((c & 0xf0) == 0xe0) {
+			return lead + 3 <= len ? len : lead;
+		} else if ((c & 0xf8) == 0xf0) {
+			return lead + 4 <= len ? len : lead;
+		}
+		/* not UTF-8 anyway */
+		return len;
+	}
+
+	return len;
+}
+
+size_t job_output_flush_len(job_t *job, bool lines, bool all)
+{
+	char *newline;
+
+	if (all || !job->output_len) {
+		return job->output_len;
+	}
+
+	if (lines) {
+		newline = memrchr(job->output, '\n', job->output_len);
+		if (newline) {
+			return newline - job->output + 1;
+		}
+	}
+
+	return utf8_boundary(job->output, job->output_len);
+}
+
+void job_output_consume(job_t *job, size_t len)
+{
+	memmove(job->output, job->output + len, job->output_len - len);
+	job->output_len -= len;
+}
+
+size_t job_error_chunk(job_t *job, char *buffer, size_t len, bool all)
+{
+	size_t cut = all ? len : utf8_boundary(buffer, len);
+
+	job->error_carry_len = len - cut;
+	memcpy(job->error_carry, buffer + cut, job->error_carry_len);
+
+	return cut;
+}
+
+void job_scan_version_output(job_t *job, const char *output)
+{
+	static const char * const markers[] = {
+		"new OS version available: ",
+		"Latest server version: ",
+		NULL
+	};
+	const char * const *marker;
+
+	for (marker = markers; *marker; marker++) {
+		const char *found = strstr(output, *marker);
+
+		if (found) {
+			job->version = strtoul(found + strlen(*marker), NULL, 10);
+			return;
+		}
+	}
+}
+
+int job_caller_status(job_t *job, job_caller_t *caller, int status)
+{
+	struct list *bundle;
+
+	/* Without any bundle named the failure is a general one */
+	if (status == 0 || !job->failed_bundles) {
+		return status;
+	}
+
+	for (bundle = list_head(caller->bundles); bundle; bundle = bundle->next) {
+		if (string_in_list(job->failed_bundles, bundle->data)) {
+			return status;
+		}
+	}
+
+	return 0;
+}
+
+bool job_is_idempotent(job_t *job)
+{
+	switch (job->method) {
+	case METHOD_CHECK_UPDATE:
+	case METHOD_HASH_DUMP:
+	case METHOD_SEARCH:
+		return true;
+	case METHOD_VERIFY:
+		return !job_has_arg(job, "--fix") && !job_has_arg(job, "--install");
+	default:
+		return false;
+	}
+}
+
+bool job_same_command(job_t *a, job_t *b)
+{
+	struct list *item_a = list_head(a->args);
+	struct list *item_b = list_head(b->args);
+
+	if (a->method != b->method || a->output_sink >= 0 || b->output_sink >= 0) {
+		return false;
+	}
+
+	while (item_a && item_b) {
+		if (strcmp(item_a->data, item_b->data) != 0) {
+			return false;
+		}
+		item_a = item_a->next;
+		item_b = item_b->next;
+	}
+
+	return !item_a && !item_b;
+}
+
+/* Returns the value following option opt in the job's argv */
+static const char *job_get_option(job_t *job, const char *opt, const char *def)
+{
+	struct list *item = list_head(job->args);
+
+	while (item && item->next) {
+		if (strcmp(item->data, opt) == 0) {
+			return item->next->data;
+		}
+		item = item->next;
+	}
+
+	return def;
+}
+
+/* Fixing verifications and search index initialization modify the system
+ * just like an update does */
+static method_t job_access_method(job_t *job)
+{
+	if ((job->method == METHOD_VERIFY &&
+	     (job_has_arg(job, "--fix") || job_has_arg(job, "--install"))) ||
+	    (job->method == METHOD_SEARCH && job_has_arg(job, "--init"))) {
+		return METHOD_UPDATE;
+	}
+
+	return job->method;
+}
+
+bool job_conflicts(job_t *a, job_t *b)
+{
+	if (!_method_conflicts[job_access_method(a)][job_access_method(b)]) {
+		return false;
+	}
+
+	return strcmp(job_get_option(a, "--statedir", SWUPD_DEFAULT_STATEDIR),
+		      job_get_option(b, "--statedir", SWUPD_DEFAULT_STATEDIR)) == 0 ||
+	       strcmp(job_get_option(a, "--path", SWUPD_DEFAULT_PATH),
+		      job_get_option(b, "--path", SWUPD_DEFAULT_PATH)) == 0;
+}
+
+bool job_conflicts_with_any(job_t *job, struct list *jobs)
+{
+	struct list *item;
+
+	for (item = list_head(jobs); item; item = item->next) {
+		if (job_conflicts(job, item->data)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static job_share_t *job_queue_find_share(job_queue_t *queue, uid_t uid)
+{
+	struct list *item = list_head(queue->shares);
+
+	while (item) {
+		job_share_t *share = item->data;
+
+		if (share->uid == uid) {
+			return share;
+		}
+		item = item->next;
+	}
+
+	return NULL;
+}
+
+static unsigned int job_queue_count_user_jobs(job_queue_t *queue, uid_t uid)
+{
+	struct list *item = list_head(queue->jobs);
+	unsigned int count = 0;
+
+	while (item) {
+		job_t *job = item->data;
+
+		if (job->uid == uid) {
+			count++;
+		}
+		item = item->next;
+	}
+
+	return count;
+}
+
+int job_queue_push(job_queue_t *queue, job_t *job)
+{
+	struct list *item;
+
+	if (!job_queue_find_share(queue, job->uid)) {
+		job_share_t *share = calloc(1, sizeof(job_share_t));
+		unsigned int served = 0;
+		bool first = true;
+
+		if (!share) {
+			return -ENOMEM;
+		}
+
+		/* Newcomers start level with the least served user, otherwise
+		 * they would either starve others or be starved themselves */
+		for (item = list_head(queue->shares); item; item = item->next) {
+			job_share_t *other = item->data;
+
+			if (first || other->served < served) {
+				served = other->served;
+				first = false;
+			}
+		}
+
+		share->uid = job->uid;
+		share->served = served;
+		item = list_append_data(queue->shares, share);
+		if (!item) {
+			free(share);
+			return -ENOMEM;
+		}
+		queue->shares = list_head(item);
+	}
+
+	/* an unused share left behind is harmless */
+	item = list_append_data(queue->jobs, job);
+	if (!item) {
+		return -ENOMEM;
+	}
+	queue->jobs = list_head(item);
+	queue->len++;
+
+	return 0;
+}
+
+void job_queue_remove(job_queue_t *queue, job_t *job)
+{
+	struct list *item = list_head(queue->jobs);
+
+	while (item && item->data != job) {
+		item = item->next;
+	}
+	if (!item) {
+		return;
+	}
+
+	if (item == queue->jobs) {
+		queue->jobs = item->next;
+	}
+	list_free_item(item, NULL);
+	queue->len--;
+
+	if (job_queue_count_user_jobs(queue, job->uid) > 0) {
+		return;
+	}
+
+	/* Forget about users without queued jobs */
+	for (item = list_head(queue->shares); item; item = item->next) {
+		job_share_t *share = item->data;
+
+		if (share->uid == job->uid) {
+			if (item == queue->shares) {
+				queue->shares = item->next;
+			}
+			list_free_item(item, free);
+			break;
+		}
+	}
+}
+
+job_t *job_queue_pop(job_queue_t *queue, struct list *running, uint64_t now,
+		     job_priority_t lowest)
+{
+	struct list *passed = NULL;
+	struct list *item;
+	job_t *next;
+
+	for (;;) {
+		unsigned int next_served = 0;
+
+		next = NULL;
+		for (item = list_head(queue->jobs); item; item = item->next) {
+			job_t *job = item->data;
+			job_share_t *share = job_queue_find_share(queue, job->uid);
+
+			if (list_find_data(passed, job) || job->priority > lowest) {
+				continue;
+			}
+			if (!next || job->priority < next->priority ||
+			    (job->priority == next->priority && share->served < next_served)) {
+				next = job;
+				next_served = share->served;
+			}
+		}
+
+		if (!next || (next->not_before <= now &&
+			      !job_conflicts_with_any(next, running) &&
+			      !job_conflicts_with_any(next, passed))) {
+			break;
+		}
+		passed = list_append_data(passed, next);
+	}
+	list_free_list(passed);
+
+	if (next) {
+		job_queue_find_share(queue, next->uid)->served++;
+		job_queue_remove(queue, next);
+	}
+
+	return next;
+}
+
+uint64_t job_queue_next_ready(job_queue_t *queue, uint64_t now)
+{
+	struct list *item;
+	uint64_t next = 0;
+
+	for (item = list_head(queue->jobs); item; item = item->next) {
+		job_t *job = item->data;
+
+		if (job->not_before > now && (!next || job->not_before < next)) {
+			next = job->not_before;
+		}
+	}
+
+	return next;
+}
+
+job_t *job_queue_evict(job_queue_t *queue, job_priority_t priority)
+{
+	struct list *item;
+
+	for (item = list_tail(queue->jobs); item; item = item->prev) {
+		job_t *job = item->data;
+
+		if (job->priority > priority) {
+			job_queue_remove(queue, job);
+			return job;
+		}
+	}
+
+	return NULL;
+}
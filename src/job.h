@@ -0,0 +1,271 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#ifndef JOB_H
+#define JOB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <systemd/sd-event.h>
+#include <systemd/sd-bus.h>
+
+#include "list.h"
+#include "scope.h"
+#include "ring.h"
+#include "progress.h"
+#include "filter.h"
+
+#define SWUPD_DEFAULT_STATEDIR "/var/lib/swupd"
+
+typedef enum {
+	METHOD_NOTSET = 0,
+	METHOD_CHECK_UPDATE,
+	METHOD_UPDATE,
+	METHOD_VERIFY,
+	METHOD_BUNDLE_ADD,
+	METHOD_BUNDLE_REMOVE,
+	METHOD_HASH_DUMP,
+	METHOD_SEARCH
+} method_t;
+
+typedef enum {
+	JOB_PRIORITY_INTERACTIVE = 0,
+	JOB_PRIORITY_BACKGROUND,
+	JOB_PRIORITY_MAX
+} job_priority_t;
+
+/* Streams of the child's output */
+#define JOB_STREAM_STDOUT (1 << 0)
+#define JOB_STREAM_STDERR (1 << 1)
+#define JOB_STREAM_ALL (JOB_STREAM_STDOUT | JOB_STREAM_STDERR)
+
+typedef struct _job_caller {
+	/* unique bus name of the requester */
+	char *name;
+	uid_t uid;
+	/* bundles the requester asked to add or remove */
+	struct list *bundles;
+	/* JOB_STREAM_* mask of the output the requester gets */
+	unsigned int streams;
+	/* lines of output the requester gets, NULL for all of them */
+	filter_t *filter;
+	/* request the reply is held back for until the job completes, NULL
+	 * if the requester got its reply on submission */
+	sd_bus_message *request;
+} job_caller_t;
+
+typedef struct _job {
+	uint64_t id;
+	method_t method;
+	/* JOB_PRIORITY_MAX until the class is chosen on submission */
+	job_priority_t priority;
+	/* argv of the swupd command to run */
+	struct list *args;
+	/* job_caller_t entries of everyone waiting for the job's results,
+	 * identical requests share a single job */
+	struct list *callers;
+	/* unique bus name of the last caller who cancelled the job, it
+	 * still waits for the outcome, and the request it waits with for
+	 * the reply */
+	char *canceller;
+	sd_bus_message *canceller_request;
+	/* bundles named by the request being submitted, handed over to
+	 * the job_caller_t entry of the requester */
+	struct list *bundles;
+	/* streams and filter the request being submitted asked for, and
+	 * whether it waits for the job to complete, likewise */
+	unsigned int streams;
+	filter_t *filter;
+	bool wait;
+	/* bundles swupd reported failures for */
+	struct list *failed_bundles;
+	/* OS version found by a check, or being downloaded ahead */
+	uint32_t version;
+	/* the job downloads content for the update to come */
+	bool predownload;
+	/* user the job is accounted to */
+	uid_t uid;
+	/* CLOCK_MONOTONIC time the job may not be started before */
+	uint64_t not_before;
+	/* CLOCK_MONOTONIC time the job was queued at */
+	uint64_t queued_at;
+	/* CLOCK_REALTIME time swupd was started at */
+	uint64_t started_at;
+	/* the outcome has been reported, the job is only kept for its
+	 * output */
+	bool completed;
+	/* resources the child may take, overrides given with the request
+	 * until the job is submitted */
+	scope_budget_t budget;
+	/* transient systemd unit the child runs in */
+	char *scope;
+	/* pending request for the scope, the child waits for it at gate_fd
+	 * before it execs */
+	scope_request_t *scope_request;
+	int gate_fd;
+	pid_t pid;
+	int pidfd;
+	int output_fd;
+	/* stderr of the child, forwarded as is */
+	int error_fd;
+	/* watches of output_fd and error_fd, disabled while the bus can't
+	 * keep up with the output */
+	sd_event_source *output_source;
+	sd_event_source *error_source;
+	/* tail of an UTF-8 character split between reads from error_fd */
+	char error_carry[4];
+	size_t error_carry_len;
+	/* descriptor of the caller the child writes its stdout to directly,
+	 * bypassing the bus, handed over to the child on spawning */
+	int output_sink;
+	/* stdout went to the caller's descriptor, the daemon never saw it */
+	bool output_bypassed;
+	/* output read from the child but not forwarded to clients yet */
+	char *output;
+	size_t output_len;
+	size_t output_size;
+	/* output kept for clients catching up */
+	ring_t history;
+	/* progress parsed from the output */
+	progress_t progress;
+	/* CLOCK_MONOTONIC time the progress was last reported at */
+	uint64_t progress_sent_at;
+	/* ChildOutputReceived signals emitted for the job */
+	uint64_t output_signals;
+	/* the child has been reaped, its exit status is final */
+	bool exited;
+	int status;
+	/* the child is frozen or stopped */
+	bool paused;
+	/* the child was paused by stopping its process group as its cgroup
+	 * couldn't be frozen */
+	bool paused_by_signal;
+	/* the child was paused because of the host's load rather than on
+	 * request, and gets resumed once the load drops */
+	bool paused_by_pressure;
+	/* CLOCK_MONOTONIC time of the last pause */
+	uint64_t paused_at;
+	/* time spent paused before the last pause */
+	uint64_t paused_usec;
+	/* resources used by the child as reported on reaping */
+	struct rusage rusage;
+} job_t;
+
+typedef struct _job_queue {
+	/* jobs in order of arrival */
+	struct list *jobs;
+	/* job_share_t entries of users having queued jobs */
+	struct list *shares;
+	unsigned int len;
+} job_queue_t;
+
+/* Name of the D-Bus method a request came in through */
+const char *job_method_name(method_t method);
+/* Returns METHOD_NOTSET for unknown names */
+method_t job_method_from_name(const char *name);
+
+job_t *job_new(method_t method);
+void job_free(void *data);
+
+/* Takes over the list of bundles */
+job_caller_t *job_add_caller(job_t *job, const char *name, uid_t uid, struct list *bundles);
+job_caller_t *job_find_caller(job_t *job, const char *name);
+void job_remove_caller(job_t *job, job_caller_t *caller);
+
+/* Returns the time the job has spent paused up to now */
+uint64_t job_get_paused_usec(job_t *job, uint64_t now);
+
+/* Returns true if the job's argv contains arg */
+bool job_has_arg(job_t *job, const char *arg);
+
+/* Appends the union of all callers' bundles to the job's argv */
+void job_add_bundle_args(job_t *job);
+
+/* Remembers bundles a chunk of swupd output reports failures for */
+void job_scan_bundle_output(job_t *job, const char *output);
+
+/* Makes room for len more bytes of output and returns where they go. The
+ * caller accounts for the bytes it actually stores in output_len. There
+ * is always room for a terminating NUL past the output. */
+char *job_output_reserve(job_t *job, size_t len);
+
+/* Returns how much of the buffered output can be forwarded in one piece.
+ * Unless all output is wanted the piece ends at the last complete line
+ * if lines is set, and never in the middle of an UTF-8 character. */
+size_t job_output_flush_len(job_t *job, bool lines, bool all);
+
+/* Drops len bytes forwarded from the start of the output buffer */
+void job_output_consume(job_t *job, size_t len);
+
+/* Returns how much of a chunk of stderr, which starts with the bytes
+ * carried over from the previous one, can be forwarded without splitting
+ * a character. The rest is carried over to the next chunk. */
+size_t job_error_chunk(job_t *job, char *buffer, size_t len, bool all);
+
+/* Remembers the OS version a chunk of check-update output announces */
+void job_scan_version_output(job_t *job, const char *output);
+
+/* Returns the exit status as seen by one of the callers of a job handling
+ * bundles for several of them: failures of other callers' bundles don't
+ * concern the caller */
+int job_caller_status(job_t *job, job_caller_t *caller, int status);
+
+/* Returns true if running the job once for several callers gives each of
+ * them the same answer as running it for each one separately */
+bool job_is_idempotent(job_t *job);
+
+/* Returns true if both jobs run the very same swupd command. Jobs writing
+ * their output to a caller's descriptor are never the same as another. */
+bool job_same_command(job_t *a, job_t *b);
+
+/* Returns true if the jobs must not run at the same time because they
+ * work on the same state directory or path and at least one of them
+ * changes it in a way the other can't cope with */
+bool job_conflicts(job_t *a, job_t *b);
+bool job_conflicts_with_any(job_t *job, struct list *jobs);
+
+/* Returns -ENOMEM if the job couldn't be queued */
+int job_queue_push(job_queue_t *queue, job_t *job);
+
+/* Removes and returns the job to run next: jobs of a higher priority class
+ * go first, within a class the user who got the least jobs served wins,
+ * ties are resolved in order of arrival. Jobs conflicting with any of the
+ * running ones or with a job preferred over them are skipped, so a waiting
+ * update doesn't get starved by a stream of verifications. Jobs not ready
+ * before now count as skipped. Jobs of a class below lowest are held and
+ * ignored altogether. Returns NULL if no job can be started. */
+job_t *job_queue_pop(job_queue_t *queue, struct list *running, uint64_t now,
+		     job_priority_t lowest);
+
+/* Returns the earliest time a queued job becomes ready to start at, or 0
+ * if there are no jobs waiting for a point in time */
+uint64_t job_queue_next_ready(job_queue_t *queue, uint64_t now);
+
+/* Removes and returns the most recently queued job of a priority class
+ * lower than the given one, or NULL if there is no such job. */
+job_t *job_queue_evict(job_queue_t *queue, job_priority_t priority);
+
+/* Removes the job from queue without freeing it */
+void job_queue_remove(job_queue_t *queue, job_t *job);
+
+#endif /* JOB_H */
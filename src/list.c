@@ -204,7 +204,6 @@ unsigned int list_len(struct list *list)
 	return len;
 }
 
-#if 0
 struct list *list_find_data(struct list *list, void *data)
 {
 	list = list_head(list);
@@ -217,7 +216,6 @@ struct list *list_find_data(struct list *list, void *data)
 
 	return NULL;
 }
-#endif
 
 struct list *list_sort(struct list *list, comparison_fn_t comparison_fn)
 {
@@ -0,0 +1,102 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "osinfo.h"
+#include "statefile.h"
+#include "log.h"
+
+void osinfo_init(osinfo_t *info)
+{
+	memset(info, 0, sizeof(*info));
+	info->check_status = -1;
+}
+
+uint32_t osinfo_read_version(const char *path)
+{
+	FILE *file;
+	char *line = NULL;
+	size_t len = 0;
+	uint32_t version = 0;
+
+	file = fopen(path, "re");
+	if (!file) {
+		return 0;
+	}
+	while (getline(&line, &len, file) > 0) {
+		const char *value;
+
+		if (strncmp(line, "VERSION_ID=", strlen("VERSION_ID=")) != 0) {
+			continue;
+		}
+		value = line + strlen("VERSION_ID=");
+		/* the value may be quoted */
+		if (*value == '"' || *value == '\'') {
+			value++;
+		}
+		if (sscanf(value, "%" SCNu32, &version) != 1) {
+			version = 0;
+		}
+		break;
+	}
+	free(line);
+	fclose(file);
+
+	return version;
+}
+
+int osinfo_load(osinfo_t *info, const char *path)
+{
+	FILE *file;
+
+	file = fopen(path, "re");
+	if (!file) {
+		return errno == ENOENT ? 0 : -errno;
+	}
+	if (fscanf(file, "%" SCNu32 " %" SCNd32 " %" SCNu64 " %" SCNu64,
+		   &info->available_version, &info->check_status,
+		   &info->check_time, &info->update_time) != 4) {
+		osinfo_init(info);
+	}
+	fclose(file);
+
+	return 0;
+}
+
+int osinfo_save(const osinfo_t *info, const char *path)
+{
+	int r;
+
+	r = statefile_write(path, "%" PRIu32 " %" PRId32 " %" PRIu64 " %" PRIu64 "\n",
+			    info->available_version, info->check_status,
+			    info->check_time, info->update_time);
+	if (r < 0) {
+		ERR("Can't save OS state to %s: %s", path, strerror(-r));
+	}
+	return r;
+}
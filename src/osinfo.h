@@ -0,0 +1,55 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#ifndef OSINFO_H
+#define OSINFO_H
+
+#include <stdint.h>
+
+#define OSINFO_STATE_FILE LOCALSTATEDIR "/lib/swupdd/os"
+#define OSINFO_OS_RELEASE_FILE "/usr/lib/os-release"
+
+/* What the daemon learnt about the OS from checks and updates run against
+ * the system's defaults */
+typedef struct _osinfo {
+	/* VERSION_ID of os-release, 0 if unknown */
+	uint32_t installed_version;
+	/* version the last check found, 0 if there is none newer */
+	uint32_t available_version;
+	/* exit status of the last check, -1 if none ran yet */
+	int32_t check_status;
+	/* CLOCK_REALTIME times of the last check and the last update
+	 * applied, 0 if never */
+	uint64_t check_time;
+	uint64_t update_time;
+} osinfo_t;
+
+void osinfo_init(osinfo_t *info);
+
+/* Returns the VERSION_ID of an os-release file, 0 if it can't be read */
+uint32_t osinfo_read_version(const char *path);
+
+/* The results outlive the daemon exiting when idle. The installed version
+ * is not saved, it's read from os-release instead. */
+int osinfo_load(osinfo_t *info, const char *path);
+int osinfo_save(const osinfo_t *info, const char *path);
+
+#endif /* OSINFO_H */
@@ -0,0 +1,135 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <grp.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <systemd/sd-daemon.h>
+
+#include "peer.h"
+#include "log.h"
+
+int peer_listen(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char *dir;
+	int fd;
+	int n;
+
+	n = sd_listen_fds(true);
+	for (fd = SD_LISTEN_FDS_START; n > 0 && fd < SD_LISTEN_FDS_START + n; fd++) {
+		if (sd_is_socket_unix(fd, SOCK_STREAM, 1, path, 0) > 0) {
+			return fd;
+		}
+	}
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		return -ENAMETOOLONG;
+	}
+	strcpy(addr.sun_path, path);
+
+	dir = strdup(path);
+	if (!dir) {
+		return -ENOMEM;
+	}
+	if (mkdir(dirname(dir), 0755) < 0 && errno != EEXIST) {
+		free(dir);
+		return -errno;
+	}
+	free(dir);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		return -errno;
+	}
+	/* left behind by a previous instance */
+	unlink(path);
+	/* access is checked against the peer's credentials instead */
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+	    chmod(path, 0666) < 0 ||
+	    listen(fd, SOMAXCONN) < 0) {
+		int r = -errno;
+
+		close(fd);
+		return r;
+	}
+
+	return fd;
+}
+
+int peer_accept(int listen_fd, struct ucred *cred)
+{
+	socklen_t len = sizeof(*cred);
+	int fd;
+
+	fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (fd < 0) {
+		return -errno;
+	}
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, cred, &len) < 0) {
+		int r = -errno;
+
+		close(fd);
+		return r;
+	}
+
+	return fd;
+}
+
+bool peer_authorized(const struct ucred *cred, gid_t group)
+{
+	struct passwd *pw;
+	gid_t *groups;
+	int ngroups = 0;
+	bool member = false;
+	int i;
+
+	if (group == (gid_t) -1 || cred->uid == 0 || cred->gid == group) {
+		return true;
+	}
+
+	/* supplementary groups of the user */
+	pw = getpwuid(cred->uid);
+	if (!pw) {
+		return false;
+	}
+	getgrouplist(pw->pw_name, pw->pw_gid, NULL, &ngroups);
+	groups = calloc(ngroups, sizeof(gid_t));
+	if (!groups) {
+		return false;
+	}
+	if (getgrouplist(pw->pw_name, pw->pw_gid, groups, &ngroups) >= 0) {
+		for (i = 0; i < ngroups && !member; i++) {
+			member = groups[i] == group;
+		}
+	}
+	free(groups);
+
+	return member;
+}
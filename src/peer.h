@@ -0,0 +1,48 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#ifndef PEER_H
+#define PEER_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/* Socket local clients may talk D-Bus to the daemon over directly, sparing
+ * the broker from relaying every request and every chunk of output */
+#define PEER_SOCKET_PATH "/run/swupdd/bus"
+
+/* defined by <sys/socket.h> with _GNU_SOURCE only */
+struct ucred;
+
+/* Returns the listening socket passed by systemd for path, or binds a new
+ * one to it */
+int peer_listen(const char *path);
+
+/* Accepts a connection and returns its descriptor along with the
+ * credentials of the peer as the kernel reports them */
+int peer_accept(int listen_fd, struct ucred *cred);
+
+/* Returns true if the peer is root or a member of group, which is
+ * (gid_t) -1 if everyone is allowed */
+bool peer_authorized(const struct ucred *cred, gid_t group);
+
+#endif /* PEER_H */
@@ -0,0 +1,125 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/statvfs.h>
+
+#include "pressure.h"
+
+/* Returns the "some avg10" value of a PSI file, or -1 */
+static double read_psi(const char *psi_path, const char *resource)
+{
+	char *path = NULL;
+	double value = -1;
+	FILE *file;
+
+	if (asprintf(&path, "%s/%s", psi_path, resource) < 0) {
+		return -1;
+	}
+	file = fopen(path, "re");
+	free(path);
+	if (!file) {
+		return -1;
+	}
+	if (fscanf(file, "some avg10=%lf", &value) != 1) {
+		value = -1;
+	}
+	fclose(file);
+
+	return value;
+}
+
+static double read_load(const char *loadavg_path)
+{
+	double value = -1;
+	long cpus;
+	FILE *file;
+
+	file = fopen(loadavg_path, "re");
+	if (!file) {
+		return -1;
+	}
+	if (fscanf(file, "%lf", &value) != 1) {
+		value = -1;
+	}
+	fclose(file);
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (value < 0 || cpus <= 0) {
+		return -1;
+	}
+
+	return value * 100 / cpus;
+}
+
+void pressure_read(const char *psi_path, const char *loadavg_path, const char *statedir,
+		   pressure_sample_t *sample)
+{
+	struct statvfs st;
+
+	if (!psi_path) {
+		psi_path = PRESSURE_DEFAULT_PATH;
+	}
+	if (!loadavg_path) {
+		loadavg_path = PRESSURE_DEFAULT_LOADAVG_PATH;
+	}
+
+	sample->cpu = read_psi(psi_path, "cpu");
+	sample->io = read_psi(psi_path, "io");
+	sample->memory = read_psi(psi_path, "memory");
+	sample->load = read_load(loadavg_path);
+
+	if (statvfs(statedir, &st) == 0) {
+		sample->disk_free = (uint64_t) st.f_bavail * st.f_frsize;
+	} else {
+		sample->disk_free = UINT64_MAX;
+	}
+}
+
+const char *pressure_exceeded(const pressure_limits_t *limits,
+			      const pressure_sample_t *sample,
+			      unsigned int percent)
+{
+	if (limits->cpu && sample->cpu > limits->cpu * percent / 100.0) {
+		return "cpu";
+	}
+	if (limits->io && sample->io > limits->io * percent / 100.0) {
+		return "io";
+	}
+	if (limits->memory && sample->memory > limits->memory * percent / 100.0) {
+		return "memory";
+	}
+	if (limits->load && sample->load > limits->load * percent / 100.0) {
+		return "load";
+	}
+	/* free space doesn't fluctuate, no need to scale it */
+	if (limits->disk_free && sample->disk_free < limits->disk_free) {
+		return "disk";
+	}
+
+	return NULL;
+}
@@ -0,0 +1,66 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+
+#ifndef PRESSURE_H
+#define PRESSURE_H
+
+#include <stdint.h>
+
+#define PRESSURE_DEFAULT_PATH "/proc/pressure"
+#define PRESSURE_DEFAULT_LOADAVG_PATH "/proc/loadavg"
+
+/* Load the host is under. Values that couldn't be read are negative, or
+ * UINT64_MAX in case of disk_free. */
+typedef struct _pressure_sample {
+	/* "some avg10" of the PSI files, in percent */
+	double cpu;
+	double io;
+	double memory;
+	/* 1 minute load average per online CPU, in percent */
+	double load;
+	/* bytes available to unprivileged users in swupd's state directory */
+	uint64_t disk_free;
+} pressure_sample_t;
+
+/* Limits background jobs are held back at, 0 disables a limit */
+typedef struct _pressure_limits {
+	unsigned int cpu;
+	unsigned int io;
+	unsigned int memory;
+	unsigned int load;
+	uint64_t disk_free;
+} pressure_limits_t;
+
+/* Takes samples from the PSI files in psi_path, the load average file at
+ * loadavg_path and the file system statedir is on. NULL paths stand for
+ * the defaults. */
+void pressure_read(const char *psi_path, const char *loadavg_path, const char *statedir,
+		   pressure_sample_t *sample);
+
+/* Returns the name of the first limit the sample exceeds, or NULL. The
+ * limits are scaled to percent of their values first, which lets callers
+ * wait for pressure to drop well below the limits before they relax. */
+const char *pressure_exceeded(const pressure_limits_t *limits,
+			      const pressure_sample_t *sample,
+			      unsigned int percent);
+
+#endif /* PRESSURE_H */
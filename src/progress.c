@@ -0,0 +1,151 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "progress.h"
+
+static const char * const _phase_names[PROGRESS_MAX] = {
+	[PROGRESS_NONE] = "none",
+	[PROGRESS_VERSION_CHECK] = "version-check",
+	[PROGRESS_MANIFESTS] = "manifests",
+	[PROGRESS_PACKS] = "packs",
+	[PROGRESS_STAGING] = "staging",
+	[PROGRESS_INSTALLING] = "installing",
+	[PROGRESS_VERIFYING] = "verifying",
+};
+
+/* Messages swupd starts its phases with */
+static const struct {
+	const char *marker;
+	progress_phase_t phase;
+} _phase_markers[] = {
+	{ "Attempting to download version string", PROGRESS_VERSION_CHECK },
+	{ "Querying server version", PROGRESS_VERSION_CHECK },
+	{ "Preparing to update from", PROGRESS_MANIFESTS },
+	{ "Querying current manifest", PROGRESS_MANIFESTS },
+	{ "Downloading packs", PROGRESS_PACKS },
+	{ "Starting download of remaining update content", PROGRESS_PACKS },
+	{ "Staging file content", PROGRESS_STAGING },
+	{ "Applying update", PROGRESS_INSTALLING },
+	{ "Installing bundle", PROGRESS_INSTALLING },
+	{ "Verifying version", PROGRESS_VERIFYING },
+	{ "Checking for corrupt files", PROGRESS_VERIFYING },
+	{ NULL, PROGRESS_NONE }
+};
+
+const char *progress_phase_name(progress_phase_t phase)
+{
+	return phase < PROGRESS_MAX ? _phase_names[phase] : _phase_names[PROGRESS_NONE];
+}
+
+/* Reads counters like "(3 of 12)", "45%" and "Inspected 1024 files" */
+static bool scan_counters(progress_t *progress, const char *line, size_t len)
+{
+	const char *p;
+	const char *end = line + len;
+	unsigned long long a;
+	unsigned long long b;
+	char *next;
+
+	for (p = line; p < end; p++) {
+		if (!isdigit(*p) || (p > line && isdigit(p[-1]))) {
+			continue;
+		}
+		a = strtoull(p, &next, 10);
+		if (next >= end) {
+			break;
+		}
+		if (*next == '%' && a <= 100) {
+			progress->percent = a;
+			return true;
+		}
+		if (strncmp(next, " of ", 4) == 0 && next + 4 < end && isdigit(next[4])) {
+			b = strtoull(next + 4, NULL, 10);
+			if (b && a <= b) {
+				progress->done = a;
+				progress->total = b;
+				progress->percent = a * 100 / b;
+				return true;
+			}
+		}
+	}
+
+	p = memmem(line, len, "Inspected ", 10);
+	if (p && p + 10 < end && isdigit(p[10])) {
+		progress->done = strtoull(p + 10, NULL, 10);
+		return true;
+	}
+
+	return false;
+}
+
+bool progress_scan(progress_t *progress, const char *output, uint64_t now)
+{
+	const char *line = output;
+	bool phase_changed = false;
+	int i;
+
+	while (*line) {
+		/* progress bars redraw their line after a carriage return */
+		size_t len = strcspn(line, "\n\r");
+
+		for (i = 0; _phase_markers[i].marker; i++) {
+			if (memmem(line, len, _phase_markers[i].marker, strlen(_phase_markers[i].marker))) {
+				break;
+			}
+		}
+		if (_phase_markers[i].marker && _phase_markers[i].phase != progress->phase) {
+			progress->phase = _phase_markers[i].phase;
+			progress->percent = 0;
+			progress->done = 0;
+			progress->total = 0;
+			progress->phase_started = now;
+			progress->changed = true;
+			phase_changed = true;
+		}
+		if (progress->phase != PROGRESS_NONE && scan_counters(progress, line, len)) {
+			progress->changed = true;
+		}
+
+		line += len;
+		if (*line) {
+			line++;
+		}
+	}
+
+	return phase_changed;
+}
+
+uint64_t progress_eta(const progress_t *progress, uint64_t now)
+{
+	uint64_t elapsed = now - progress->phase_started;
+
+	if (!progress->percent || progress->percent >= 100 || now < progress->phase_started) {
+		return 0;
+	}
+
+	return elapsed / progress->percent * (100 - progress->percent);
+}
@@ -0,0 +1,63 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+	PROGRESS_NONE = 0,
+	PROGRESS_VERSION_CHECK,
+	PROGRESS_MANIFESTS,
+	PROGRESS_PACKS,
+	PROGRESS_STAGING,
+	PROGRESS_INSTALLING,
+	PROGRESS_VERIFYING,
+	PROGRESS_MAX
+} progress_phase_t;
+
+/* Progress of a swupd run as far as its output tells */
+typedef struct _progress {
+	progress_phase_t phase;
+	/* of the current phase, 0 to 100 */
+	unsigned int percent;
+	/* items the current phase is done with and has to handle, files
+	 * or packs depending on the phase, 0 if swupd didn't tell */
+	uint64_t done;
+	uint64_t total;
+	/* CLOCK_MONOTONIC time the current phase started at */
+	uint64_t phase_started;
+	/* the progress changed since it was last reported */
+	bool changed;
+} progress_t;
+
+const char *progress_phase_name(progress_phase_t phase);
+
+/* Updates the progress from the lines of a chunk of output, now is the
+ * time the output was read at. Returns true if the phase changed. */
+bool progress_scan(progress_t *progress, const char *output, uint64_t now);
+
+/* Returns the estimated time left in the current phase, 0 if unknown */
+uint64_t progress_eta(const progress_t *progress, uint64_t now);
+
+#endif /* PROGRESS_H */
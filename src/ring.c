@@ -0,0 +1,102 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ring.h"
+
+void ring_init(ring_t *ring, size_t size)
+{
+	ring->data = NULL;
+	ring->size = size;
+	ring->end = 0;
+}
+
+void ring_free(ring_t *ring)
+{
+	free(ring->data);
+	ring->data = NULL;
+}
+
+uint64_t ring_start(const ring_t *ring)
+{
+	return ring->end > ring->size ? ring->end - ring->size : 0;
+}
+
+int ring_append(ring_t *ring, const char *buffer, size_t len)
+{
+	size_t pos;
+	size_t chunk;
+
+	if (!ring->size) {
+		ring->end += len;
+		return 0;
+	}
+
+	/* most jobs never fill the ring, so it is allocated on first use */
+	if (!ring->data) {
+		ring->data = malloc(ring->size);
+		if (!ring->data) {
+			return -ENOMEM;
+		}
+	}
+
+	/* only the tail of a chunk larger than the ring would be kept */
+	if (len > ring->size) {
+		ring->end += len - ring->size;
+		buffer += len - ring->size;
+		len = ring->size;
+	}
+
+	pos = ring->end % ring->size;
+	chunk = ring->size - pos < len ? ring->size - pos : len;
+	memcpy(ring->data + pos, buffer, chunk);
+	memcpy(ring->data, buffer + chunk, len - chunk);
+	ring->end += len;
+
+	return 0;
+}
+
+size_t ring_read(const ring_t *ring, uint64_t *offset, char *buffer, size_t len)
+{
+	uint64_t start = ring_start(ring);
+	size_t pos;
+	size_t chunk;
+
+	if (*offset < start) {
+		*offset = start;
+	}
+	if (*offset >= ring->end || !ring->data) {
+		return 0;
+	}
+	if (len > ring->end - *offset) {
+		len = ring->end - *offset;
+	}
+
+	pos = *offset % ring->size;
+	chunk = ring->size - pos < len ? ring->size - pos : len;
+	memcpy(buffer, ring->data + pos, chunk);
+	memcpy(buffer + chunk, ring->data, len - chunk);
+
+	return len;
+}
@@ -0,0 +1,52 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Keeps the last size bytes of a stream. Bytes are addressed by their
+ * offset from the start of the stream, so readers can tell what they have
+ * missed. */
+typedef struct _ring {
+	char *data;
+	size_t size;
+	/* offset of the byte to be appended next */
+	uint64_t end;
+} ring_t;
+
+/* A ring of size 0 keeps nothing but still counts the bytes */
+void ring_init(ring_t *ring, size_t size);
+void ring_free(ring_t *ring);
+
+/* Returns the offset of the oldest byte still kept */
+uint64_t ring_start(const ring_t *ring);
+
+int ring_append(ring_t *ring, const char *buffer, size_t len);
+
+/* Copies up to len bytes from offset on into buffer. Offsets of bytes no
+ * longer kept are moved to the oldest byte kept. Returns the number of
+ * bytes copied and the offset of the first one in offset. */
+size_t ring_read(const ring_t *ring, uint64_t *offset, char *buffer, size_t len);
+
+#endif /* RING_H */
@@ -0,0 +1,261 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "schedule.h"
+#include "statefile.h"
+#include "log.h"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+#define MINUTES_PER_DAY (24 * 60)
+
+static const char * const _task_str_map[] = {
+	"check",
+	"download",
+	"update"
+};
+
+const char *schedule_task_name(schedule_task_t task)
+{
+	return _task_str_map[task];
+}
+
+uint64_t schedule_hash_file(const char *path)
+{
+	uint64_t hash = FNV_OFFSET_BASIS;
+	FILE *file;
+	int c;
+
+	file = fopen(path, "re");
+	if (!file) {
+		return 0;
+	}
+	while ((c = fgetc(file)) != EOF) {
+		if (c == '\n') {
+			continue;
+		}
+		hash ^= (unsigned char) c;
+		hash *= FNV_PRIME;
+	}
+	fclose(file);
+
+	return hash;
+}
+
+int schedule_parse_window(schedule_t *schedule, const char *str)
+{
+	unsigned int start_hour, start_min, end_hour, end_min;
+	int len = 0;
+
+	if (sscanf(str, "%u:%u-%u:%u%n", &start_hour, &start_min, &end_hour, &end_min, &len) != 4 ||
+	    str[len] != '\0' || start_hour > 23 || end_hour > 23 || start_min > 59 || end_min > 59) {
+		return -EINVAL;
+	}
+
+	schedule->window_start = start_hour * 60 + start_min;
+	schedule->window_end = end_hour * 60 + end_min;
+
+	return 0;
+}
+
+/* Returns the first time not before t within the maintenance window the
+ * machine may run at */
+static time_t schedule_fit_window(const schedule_t *schedule, time_t t)
+{
+	unsigned int length = (schedule->window_end + MINUTES_PER_DAY - schedule->window_start) % MINUTES_PER_DAY;
+	unsigned int minute;
+	struct tm tm;
+	time_t start;
+
+	localtime_r(&t, &tm);
+	minute = tm.tm_hour * 60 + tm.tm_min;
+	if ((minute - schedule->window_start + MINUTES_PER_DAY) % MINUTES_PER_DAY < length) {
+		/* overdue runs are done right away */
+		return t;
+	}
+
+	/* The window opens later today or, if it has passed already,
+	 * tomorrow. mktime() takes care of the overflow and DST. */
+	tm.tm_hour = schedule->window_start / 60;
+	tm.tm_min = schedule->window_start % 60;
+	tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	start = mktime(&tm);
+	if (start <= t) {
+		tm.tm_mday++;
+		tm.tm_isdst = -1;
+		start = mktime(&tm);
+	}
+
+	return start + schedule->hash % (length * 60);
+}
+
+time_t schedule_next_run(const schedule_t *schedule, schedule_task_t task, time_t now)
+{
+	time_t interval = schedule->interval[task];
+	time_t last = schedule->last[task];
+	time_t offset;
+	time_t next;
+
+	if (!interval) {
+		return 0;
+	}
+
+	if (schedule->window_start != schedule->window_end) {
+		next = last ? last + interval : now;
+		return schedule_fit_window(schedule, next > now ? next : now);
+	}
+
+	offset = schedule->jitter ? schedule->hash % (schedule->jitter < interval ? schedule->jitter : interval) : 0;
+	if (last) {
+		/* the first slot after the last run */
+		next = ((last - offset) / interval + 1) * interval + offset;
+	} else {
+		/* the first slot from now on, so that machines booted at
+		 * the same time don't run all at once */
+		next = ((now - offset + interval - 1) / interval) * interval + offset;
+	}
+
+	return next > now ? next : now;
+}
+
+time_t schedule_next_any(const schedule_t *schedule, time_t now)
+{
+	schedule_task_t task;
+	time_t earliest = 0;
+
+	for (task = 0; task < SCHEDULE_MAX; task++) {
+		time_t next = schedule_next_run(schedule, task, now);
+
+		if (next && (!earliest || next < earliest)) {
+			earliest = next;
+		}
+	}
+
+	return earliest;
+}
+
+int schedule_load(schedule_t *schedule, const char *path)
+{
+	schedule_task_t task;
+	char name[16];
+	int64_t last;
+	FILE *file;
+
+	file = fopen(path, "re");
+	if (!file) {
+		return errno == ENOENT ? 0 : -errno;
+	}
+
+	while (fscanf(file, "%15s %" SCNd64, name, &last) == 2) {
+		for (task = 0; task < SCHEDULE_MAX; task++) {
+			if (strcmp(name, _task_str_map[task]) == 0) {
+				schedule->last[task] = last;
+			}
+		}
+	}
+	fclose(file);
+
+	return 0;
+}
+
+int schedule_save(const schedule_t *schedule, const char *path)
+{
+	schedule_task_t task;
+	char state[256];
+	size_t len = 0;
+	int r;
+
+	for (task = 0; task < SCHEDULE_MAX; task++) {
+		len += snprintf(state + len, sizeof(state) - len, "%s %" PRId64 "\n",
+				_task_str_map[task], (int64_t) schedule->last[task]);
+	}
+	r = statefile_write(path, "%s", state);
+	if (r < 0) {
+		ERR("Can't save schedule to %s: %s", path, strerror(-r));
+	}
+	return r;
+}
+
+int schedule_handoff(sd_bus *bus, time_t when)
+{
+	sd_bus_error error = SD_BUS_ERROR_NULL;
+	sd_bus_message *m = NULL;
+	char *timer = NULL;
+	char calendar[64];
+	struct tm tm;
+	int r;
+
+	gmtime_r(&when, &tm);
+	strftime(calendar, sizeof(calendar), "%Y-%m-%d %H:%M:%S UTC", &tm);
+
+	/* Named after the time, a timer left from an earlier run of the
+	 * daemon for the same time does the job just as well */
+	if (asprintf(&timer, "swupdd-wakeup-%" PRId64 ".timer", (int64_t) when) < 0) {
+		r = -ENOMEM;
+		goto finish;
+	}
+
+	r = sd_bus_message_new_method_call(bus, &m,
+					   "org.freedesktop.systemd1",
+					   "/org/freedesktop/systemd1",
+					   "org.freedesktop.systemd1.Manager",
+					   "StartTransientUnit");
+	if (r < 0) {
+		goto finish;
+	}
+	/* The timer starts the daemon's own service, which systemd won't
+	 * start twice when the daemon is already running because of the bus
+	 * or the socket */
+	r = sd_bus_message_append(m, "ssa(sv)a(sa(sv))", timer, "fail", 4,
+				  "Description", "s", "Wake up swupdd for scheduled maintenance",
+				  "TimersCalendar", "a(ss)", 1, "OnCalendar", calendar,
+				  "RemainAfterElapse", "b", 0,
+				  "Unit", "s", SWUPDD_SERVICE,
+				  0);
+	if (r < 0) {
+		goto finish;
+	}
+
+	r = sd_bus_call(bus, m, 0, &error, NULL);
+	if (sd_bus_error_has_name(&error, "org.freedesktop.systemd1.UnitExists")) {
+		r = 0;
+	} else if (r < 0) {
+		ERR("Can't start %s: %s", timer, error.message ? error.message : strerror(-r));
+	} else {
+		DEBUG("Handed off next maintenance run at %s to %s", calendar, timer);
+	}
+
+finish:
+	sd_bus_error_free(&error);
+	sd_bus_message_unref(m);
+	free(timer);
+	return r;
+}
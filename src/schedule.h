@@ -0,0 +1,87 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <systemd/sd-bus.h>
+
+#define SCHEDULE_STATE_FILE LOCALSTATEDIR "/lib/swupdd/schedule"
+#define SCHEDULE_DEFAULT_MACHINE_ID_PATH "/etc/machine-id"
+/* Seconds a run that couldn't be submitted is retried after */
+#define SCHEDULE_RETRY_SEC 60
+/* Unit the wakeup timers start */
+#define SWUPDD_SERVICE "swupdd.service"
+
+typedef enum {
+	SCHEDULE_CHECK = 0,
+	SCHEDULE_DOWNLOAD,
+	SCHEDULE_UPDATE,
+	SCHEDULE_MAX
+} schedule_task_t;
+
+typedef struct _schedule {
+	/* hash of the machine id every machine derives its own offsets
+	 * within intervals and windows from */
+	uint64_t hash;
+	/* seconds the runs of a task may be spread over within its interval */
+	unsigned int jitter;
+	/* maintenance window in minutes after local midnight, may wrap
+	 * around midnight, equal values stand for no window */
+	unsigned int window_start;
+	unsigned int window_end;
+	/* seconds between runs of each task, 0 disables the task */
+	unsigned int interval[SCHEDULE_MAX];
+	/* wall clock time of the last run of each task, 0 if never run */
+	time_t last[SCHEDULE_MAX];
+} schedule_t;
+
+const char *schedule_task_name(schedule_task_t task);
+
+/* Returns the FNV-1a hash of the file's contents, or 0 if it can't be
+ * read */
+uint64_t schedule_hash_file(const char *path);
+
+/* Parses "HH:MM-HH:MM" */
+int schedule_parse_window(schedule_t *schedule, const char *str);
+
+/* Returns the wall clock time the task is to run next, which is now if
+ * the task is overdue, or 0 if the task is disabled. Without maintenance
+ * window runs are aligned to the task's interval counted from the epoch,
+ * shifted by the machine's offset within the jitter. With one they fall
+ * on the machine's offset within the window. */
+time_t schedule_next_run(const schedule_t *schedule, schedule_task_t task, time_t now);
+
+/* Returns the earliest next run of any task, or 0 */
+time_t schedule_next_any(const schedule_t *schedule, time_t now);
+
+/* Remembers the times of the last runs across restarts of the daemon */
+int schedule_load(schedule_t *schedule, const char *path);
+int schedule_save(const schedule_t *schedule, const char *path);
+
+/* Asks systemd to start SWUPDD_SERVICE at the given time with a transient
+ * timer, for the daemon exits when idle */
+int schedule_handoff(sd_bus *bus, time_t when);
+
+#endif /* SCHEDULE_H */
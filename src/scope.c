@@ -0,0 +1,401 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "scope.h"
+#include "log.h"
+
+#define IOPRIO_CLASS_SHIFT 13
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+static const char * const _io_class_map[] = {
+	NULL,
+	"realtime",
+	"best-effort",
+	"idle"
+};
+
+const char *scope_io_class_name(int io_class)
+{
+	if (io_class < SCOPE_IO_CLASS_REALTIME || io_class > SCOPE_IO_CLASS_IDLE) {
+		return NULL;
+	}
+
+	return _io_class_map[io_class];
+}
+
+int scope_io_class_from_name(const char *name)
+{
+	int io_class;
+
+	for (io_class = SCOPE_IO_CLASS_REALTIME; io_class <= SCOPE_IO_CLASS_IDLE; io_class++) {
+		if (strcmp(_io_class_map[io_class], name) == 0) {
+			return io_class;
+		}
+	}
+
+	return 0;
+}
+
+/* Takes the value from defaults if there is none yet, or if the value is
+ * more generous than the default and the caller isn't allowed that */
+#define RESOLVE_LOWER(field) \
+	if (!budget->field || (!privileged && defaults->field && budget->field > defaults->field)) { \
+		budget->field = defaults->field; \
+	}
+
+void scope_budget_init(scope_budget_t *budget)
+{
+	memset(budget, 0, sizeof(scope_budget_t));
+	budget->nice = SCOPE_NICE_UNSET;
+}
+
+void scope_budget_resolve(scope_budget_t *budget, const scope_budget_t *defaults, bool privileged)
+{
+	RESOLVE_LOWER(cpu_weight);
+	RESOLVE_LOWER(io_weight);
+	RESOLVE_LOWER(memory_high);
+
+	/* A lower nice value or I/O class means a higher priority, without
+	 * a default the daemon's own nice value of 0 is the limit */
+	if (budget->nice == SCOPE_NICE_UNSET ||
+	    (!privileged && budget->nice < (defaults->nice == SCOPE_NICE_UNSET ? 0 : defaults->nice))) {
+		budget->nice = defaults->nice;
+	}
+	if (!budget->io_class ||
+	    (!privileged && budget->io_class < (defaults->io_class ? defaults->io_class : SCOPE_IO_CLASS_BEST_EFFORT))) {
+		budget->io_class = defaults->io_class;
+	}
+}
+
+int scope_budget_ioprio(const scope_budget_t *budget)
+{
+	int level;
+
+	if (!budget->io_class) {
+		return 0;
+	}
+
+	/* The same level the kernel derives from the nice value when no
+	 * I/O priority is set explicitly */
+	level = ((budget->nice == SCOPE_NICE_UNSET ? 0 : budget->nice) + 20) / 5;
+
+	return (budget->io_class << IOPRIO_CLASS_SHIFT) | level;
+}
+
+int scope_budget_append(sd_bus_message *m, const scope_budget_t *budget)
+{
+	int r = 0;
+
+	if (budget->cpu_weight) {
+		r = sd_bus_message_append(m, "{sv}", "cpu-weight", "t", budget->cpu_weight);
+		if (r < 0) {
+			return r;
+		}
+	}
+	if (budget->io_weight) {
+		r = sd_bus_message_append(m, "{sv}", "io-weight", "t", budget->io_weight);
+		if (r < 0) {
+			return r;
+		}
+	}
+	if (budget->memory_high) {
+		r = sd_bus_message_append(m, "{sv}", "memory-high", "t", budget->memory_high);
+		if (r < 0) {
+			return r;
+		}
+	}
+	if (budget->nice != SCOPE_NICE_UNSET) {
+		r = sd_bus_message_append(m, "{sv}", "nice", "i", budget->nice);
+		if (r < 0) {
+			return r;
+		}
+	}
+	if (budget->io_class) {
+		r = sd_bus_message_append(m, "{sv}", "io-class", "s", scope_io_class_name(budget->io_class));
+	}
+
+	return r;
+}
+
+struct _scope_request {
+	/* JobRemoved of the unit's start job */
+	sd_bus_slot *match;
+	/* the pending StartTransientUnit call */
+	sd_bus_slot *call;
+	char *unit;
+	scope_started_t callback;
+	void *userdata;
+};
+
+void scope_request_free(scope_request_t *request)
+{
+	if (!request) {
+		return;
+	}
+
+	sd_bus_slot_unref(request->match);
+	sd_bus_slot_unref(request->call);
+	free(request->unit);
+	free(request);
+}
+
+static void scope_request_done(scope_request_t *request, int r)
+{
+	scope_started_t callback = request->callback;
+	void *userdata = request->userdata;
+
+	scope_request_free(request);
+	callback(r, userdata);
+}
+
+static int on_scope_job_removed(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+{
+	scope_request_t *request = userdata;
+	const char *unit;
+	const char *result;
+	int r;
+
+	r = sd_bus_message_read(m, "uoss", NULL, NULL, &unit, &result);
+	if (r < 0) {
+		ERR("Can't parse JobRemoved signal: %s", strerror(-r));
+		return 0;
+	}
+	if (strcmp(unit, request->unit) != 0) {
+		return 0;
+	}
+
+	/* PIDs are moved into a scope while its start job runs, not when
+	 * the job is queued */
+	if (strcmp(result, "done") != 0) {
+		ERR("Failed to start transient scope %s: %s", unit, result);
+		r = -EIO;
+	}
+	scope_request_done(request, r < 0 ? r : 0);
+
+	return 0;
+}
+
+static int on_scope_started(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+{
+	const sd_bus_error *error = sd_bus_message_get_error(m);
+	scope_request_t *request = userdata;
+
+	if (error) {
+		ERR("Failed to start transient scope: %s", error->message);
+		scope_request_done(request, -sd_bus_error_get_errno(error));
+		return 0;
+	}
+	request->call = sd_bus_slot_unref(request->call);
+
+	return 0;
+}
+
+int scope_start(sd_bus *bus, const char *unit, const char *slice, pid_t pid,
+		const scope_budget_t *budget, scope_started_t callback, void *userdata,
+		scope_request_t **request)
+{
+	scope_request_t *req = NULL;
+	sd_bus_message *m = NULL;
+	int r;
+
+	req = calloc(1, sizeof(scope_request_t));
+	if (!req) {
+		r = -ENOMEM;
+		goto finish;
+	}
+	req->unit = strdup(unit);
+	if (!req->unit) {
+		r = -ENOMEM;
+		goto finish;
+	}
+	req->callback = callback;
+	req->userdata = userdata;
+
+	/* Subscribed to before the call is made, so that the signal can't
+	 * get ahead of the match. sd-bus can't match arg2 of JobRemoved
+	 * locally as it follows a non-string argument, the unit gets
+	 * compared in the handler instead. */
+	r = sd_bus_add_match(bus, &req->match,
+			     "type='signal',sender='org.freedesktop.systemd1',"
+			     "path='/org/freedesktop/systemd1',"
+			     "interface='org.freedesktop.systemd1.Manager',"
+			     "member='JobRemoved'",
+			     on_scope_job_removed, req);
+	if (r < 0) {
+		goto finish;
+	}
+
+	r = sd_bus_message_new_method_call(bus, &m,
+					   "org.freedesktop.systemd1",
+					   "/org/freedesktop/systemd1",
+					   "org.freedesktop.systemd1.Manager",
+					   "StartTransientUnit");
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_message_append(m, "ss", unit, "fail");
+	if (r < 0) {
+		goto finish;
+	}
+
+	r = sd_bus_message_open_container(m, SD_BUS_TYPE_ARRAY, "(sv)");
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_message_append(m, "(sv)(sv)(sv)",
+				  "Description", "s", "swupd run by swupdd",
+				  "PIDs", "au", 1, (uint32_t) pid,
+				  "CollectMode", "s", "inactive-or-failed");
+	if (r < 0) {
+		goto finish;
+	}
+	if (slice) {
+		r = sd_bus_message_append(m, "(sv)", "Slice", "s", slice);
+		if (r < 0) {
+			goto finish;
+		}
+	}
+	if (budget->cpu_weight) {
+		r = sd_bus_message_append(m, "(sv)", "CPUWeight", "t", budget->cpu_weight);
+		if (r < 0) {
+			goto finish;
+		}
+	}
+	if (budget->io_weight) {
+		r = sd_bus_message_append(m, "(sv)", "IOWeight", "t", budget->io_weight);
+		if (r < 0) {
+			goto finish;
+		}
+	}
+	if (budget->memory_high) {
+		r = sd_bus_message_append(m, "(sv)", "MemoryHigh", "t", budget->memory_high);
+		if (r < 0) {
+			goto finish;
+		}
+	}
+	r = sd_bus_message_close_container(m);
+	if (r < 0) {
+		goto finish;
+	}
+
+	/* no auxiliary units */
+	r = sd_bus_message_append(m, "a(sa(sv))", 0);
+	if (r < 0) {
+		goto finish;
+	}
+
+	r = sd_bus_call_async(bus, &req->call, m, on_scope_started, req, 0);
+	if (r < 0) {
+		goto finish;
+	}
+
+	*request = req;
+	req = NULL;
+
+finish:
+	if (r < 0) {
+		ERR("Can't request transient scope %s: %s", unit, strerror(-r));
+	}
+	scope_request_free(req);
+	sd_bus_message_unref(m);
+	return r;
+}
+
+/* Returns the cgroup v2 path of the process relative to CGROUP_ROOT */
+static char *scope_get_cgroup(pid_t pid)
+{
+	char *path = NULL;
+	char *line = NULL;
+	size_t len = 0;
+	FILE *file;
+
+	if (asprintf(&path, "/proc/%i/cgroup", pid) < 0) {
+		return NULL;
+	}
+	file = fopen(path, "re");
+	free(path);
+	path = NULL;
+	if (!file) {
+		return NULL;
+	}
+
+	/* the unified hierarchy is the one with id 0 and no controllers */
+	while (getline(&line, &len, file) > 0) {
+		if (strncmp(line, "0::", 3) == 0) {
+			line[strcspn(line, "\n")] = '\0';
+			path = strdup(line + 3);
+			break;
+		}
+	}
+
+	free(line);
+	fclose(file);
+	return path;
+}
+
+int scope_freeze(pid_t pid, const char *unit, bool frozen)
+{
+	char *cgroup;
+	char *path = NULL;
+	const char *name;
+	int fd;
+	int r = 0;
+
+	cgroup = scope_get_cgroup(pid);
+	if (!cgroup) {
+		return -EOPNOTSUPP;
+	}
+
+	name = strrchr(cgroup, '/');
+	if (!unit || !name || strcmp(name + 1, unit) != 0) {
+		r = -ENOENT;
+		goto finish;
+	}
+
+	if (asprintf(&path, CGROUP_ROOT "%s/cgroup.freeze", cgroup) < 0) {
+		r = -ENOMEM;
+		goto finish;
+	}
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		r = -errno;
+		goto finish;
+	}
+	if (write(fd, frozen ? "1" : "0", 1) < 0) {
+		r = -errno;
+	}
+	close(fd);
+
+finish:
+	free(path);
+	free(cgroup);
+	return r;
+}
@@ -0,0 +1,93 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <systemd/sd-bus.h>
+
+/* I/O scheduling classes as known to ioprio_set(2) */
+#define SCOPE_IO_CLASS_REALTIME    1
+#define SCOPE_IO_CLASS_BEST_EFFORT 2
+#define SCOPE_IO_CLASS_IDLE        3
+
+/* Leaves the nice value the daemon's, 0 is a valid value to ask for */
+#define SCOPE_NICE_UNSET INT_MIN
+
+/* Resources a swupd child is allowed to take, 0 in any of the fields but
+ * nice leaves the system's default in place */
+typedef struct _scope_budget {
+	/* cpu.weight and io.weight of the child's cgroup, 1 to 10000 */
+	uint64_t cpu_weight;
+	uint64_t io_weight;
+	/* memory.high of the child's cgroup in bytes */
+	uint64_t memory_high;
+	/* nice value, -20 to 19, or SCOPE_NICE_UNSET */
+	int nice;
+	/* SCOPE_IO_CLASS_* */
+	int io_class;
+} scope_budget_t;
+
+/* Returns a budget with nothing set */
+void scope_budget_init(scope_budget_t *budget);
+
+/* Fills the fields of budget left unset from defaults. Unless privileged,
+ * the budget can't be more generous than the defaults. */
+void scope_budget_resolve(scope_budget_t *budget, const scope_budget_t *defaults, bool privileged);
+
+/* Returns the value for ioprio_set(2) matching the budget, or 0 */
+int scope_budget_ioprio(const scope_budget_t *budget);
+
+const char *scope_io_class_name(int io_class);
+/* Returns 0 for unknown names */
+int scope_io_class_from_name(const char *name);
+
+/* Appends the budget to an open a{sv} container */
+int scope_budget_append(sd_bus_message *m, const scope_budget_t *budget);
+
+typedef struct _scope_request scope_request_t;
+
+/* Called once the process runs in the scope, or with a negative errno if
+ * it won't */
+typedef void (*scope_started_t)(int r, void *userdata);
+
+/* Asks systemd to move the process into a transient scope unit with the
+ * budget applied to it. The request is asynchronous, its outcome is
+ * passed to callback, which isn't called if the request can't be sent.
+ * Failures don't affect the process and only get logged. */
+int scope_start(sd_bus *bus, const char *unit, const char *slice, pid_t pid,
+		const scope_budget_t *budget, scope_started_t callback, void *userdata,
+		scope_request_t **request);
+
+/* Drops a pending request, its callback won't be called */
+void scope_request_free(scope_request_t *request);
+
+/* Freezes or thaws the cgroup of the process, which must be the scope
+ * unit. Returns -ENOENT if the process isn't in the unit, e.g. because
+ * systemd hasn't moved it yet. */
+int scope_freeze(pid_t pid, const char *unit, bool frozen);
+
+#endif /* SCOPE_H */
@@ -0,0 +1,127 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "staging.h"
+#include "statefile.h"
+#include "log.h"
+
+int staging_scan_start(staging_scan_t *scan, const char *statedir, uint32_t version, uint64_t since)
+{
+	char *path = NULL;
+
+	staging_scan_stop(scan);
+	if (asprintf(&path, "%s/staged", statedir) < 0) {
+		return -ENOMEM;
+	}
+	scan->dir = opendir(path);
+	free(path);
+	if (!scan->dir) {
+		return -errno;
+	}
+
+	scan->version = version;
+	scan->since = since;
+	scan->bytes = 0;
+
+	return 0;
+}
+
+int staging_scan_step(staging_scan_t *scan, unsigned int count)
+{
+	struct dirent *entry;
+	struct stat st;
+
+	/* staged content is kept flat, one file per hash */
+	while (count--) {
+		errno = 0;
+		entry = readdir(scan->dir);
+		if (!entry) {
+			return errno ? -errno : 0;
+		}
+		if (fstatat(dirfd(scan->dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+		    !S_ISREG(st.st_mode)) {
+			continue;
+		}
+		/* Extracting keeps the mtime of the content, ctime tells when
+		 * it got here. It comes from the kernel's coarse clock, so
+		 * only its seconds are compared. */
+		if ((uint64_t) st.st_ctim.tv_sec >= scan->since / 1000000) {
+			scan->bytes += st.st_size;
+		}
+	}
+
+	return 1;
+}
+
+void staging_scan_stop(staging_scan_t *scan)
+{
+	if (scan->dir) {
+		closedir(scan->dir);
+		scan->dir = NULL;
+	}
+}
+
+int staging_load(staging_t *staging, const char *path)
+{
+	FILE *file;
+
+	file = fopen(path, "re");
+	if (!file) {
+		return errno == ENOENT ? 0 : -errno;
+	}
+	if (fscanf(file, "%" SCNu32 " %" SCNu64, &staging->version, &staging->bytes) != 2) {
+		staging->version = 0;
+		staging->bytes = 0;
+	}
+	fclose(file);
+
+	return 0;
+}
+
+int staging_save(const staging_t *staging, const char *path)
+{
+	int r = 0;
+
+	if (!staging->version) {
+		if (unlink(path) < 0 && errno != ENOENT) {
+			r = -errno;
+		}
+	} else {
+		r = statefile_write(path, "%" PRIu32 " %" PRIu64 "\n", staging->version, staging->bytes);
+	}
+
+	if (r < 0) {
+		ERR("Can't save staged state to %s: %s", path, strerror(-r));
+	}
+	return r;
+}
@@ -0,0 +1,62 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+
+#ifndef STAGING_H
+#define STAGING_H
+
+#include <stdint.h>
+#include <dirent.h>
+
+#define STAGING_STATE_FILE LOCALSTATEDIR "/lib/swupdd/staged"
+
+/* Content of an OS version downloaded ahead of the update */
+typedef struct _staging {
+	/* 0 if nothing is staged */
+	uint32_t version;
+	uint64_t bytes;
+} staging_t;
+
+/* Sums up the size of the content a download staged in swupd's state
+ * directory, a batch of entries at a time. The directory keeps all content
+ * ever staged, only files staged since the download started count. */
+typedef struct _staging_scan {
+	/* NULL unless a scan is in progress */
+	DIR *dir;
+	/* the version being staged */
+	uint32_t version;
+	/* CLOCK_REALTIME time in us the download started at */
+	uint64_t since;
+	uint64_t bytes;
+} staging_scan_t;
+
+int staging_scan_start(staging_scan_t *scan, const char *statedir, uint32_t version, uint64_t since);
+/* Looks at up to count more entries. Returns 1 while there are more of
+ * them, 0 once bytes is complete or a negative errno. */
+int staging_scan_step(staging_scan_t *scan, unsigned int count);
+/* Ends the scan, if any */
+void staging_scan_stop(staging_scan_t *scan);
+
+/* The staged state outlives the daemon exiting when idle */
+int staging_load(staging_t *staging, const char *path);
+int staging_save(const staging_t *staging, const char *path);
+
+#endif /* STAGING_H */
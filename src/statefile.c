@@ -0,0 +1,81 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "statefile.h"
+
+int statefile_write(const char *path, const char *format, ...)
+{
+	char *tmp = NULL;
+	char *dir;
+	FILE *file;
+	va_list ap;
+	int r = 0;
+
+	dir = strdup(path);
+	if (!dir) {
+		return -ENOMEM;
+	}
+	if (mkdir(dirname(dir), 0755) < 0 && errno != EEXIST) {
+		r = -errno;
+		goto finish;
+	}
+
+	if (asprintf(&tmp, "%s.tmp", path) < 0) {
+		tmp = NULL;
+		r = -ENOMEM;
+		goto finish;
+	}
+	file = fopen(tmp, "we");
+	if (!file) {
+		r = -errno;
+		goto finish;
+	}
+	va_start(ap, format);
+	if (vfprintf(file, format, ap) < 0 || fflush(file) != 0 || fsync(fileno(file)) < 0) {
+		r = errno ? -errno : -EIO;
+	}
+	va_end(ap);
+	if (fclose(file) != 0 && r == 0) {
+		r = -errno;
+	}
+	if (r == 0 && rename(tmp, path) < 0) {
+		r = -errno;
+	}
+	if (r < 0) {
+		unlink(tmp);
+	}
+
+finish:
+	free(tmp);
+	free(dir);
+	return r;
+}
@@ -0,0 +1,31 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#ifndef STATEFILE_H
+#define STATEFILE_H
+
+/* Writes the formatted state to the file at path, creating its directory
+ * if needed. The file is replaced atomically, a crash or a full disk
+ * leave the previous state in place rather than a truncated one. */
+int statefile_write(const char *path, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+#endif /* STATEFILE_H */
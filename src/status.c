@@ -0,0 +1,163 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "status.h"
+#include "log.h"
+
+/* attempts of a reader before it gives up on a writer never finishing */
+#define STATUS_READ_RETRIES 1000
+
+#define STATUS_PAGE_DATA offsetof(status_page_t, updated)
+
+status_page_t *status_page_open(const char *path)
+{
+	status_page_t *page;
+	char *dir;
+	int fd;
+
+	dir = strdup(path);
+	if (!dir) {
+		return NULL;
+	}
+	if (mkdir(dirname(dir), 0755) < 0 && errno != EEXIST) {
+		ERR("Can't create directory of %s: %s", path, strerror(errno));
+		free(dir);
+		return NULL;
+	}
+	free(dir);
+
+	/* Readers may keep the page mapped across restarts of the daemon,
+	 * so it's reused rather than replaced */
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		ERR("Can't open %s: %s", path, strerror(errno));
+		return NULL;
+	}
+	if (ftruncate(fd, sizeof(status_page_t)) < 0) {
+		ERR("Can't resize %s: %s", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	page = mmap(NULL, sizeof(status_page_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		ERR("Can't map %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	/* a previous daemon may have died in the middle of an update */
+	if (__atomic_load_n(&page->sequence, __ATOMIC_RELAXED) & 1) {
+		__atomic_store_n(&page->sequence, page->sequence + 1, __ATOMIC_RELEASE);
+	}
+	page->magic = STATUS_PAGE_MAGIC;
+	page->version = STATUS_PAGE_VERSION;
+	page->pid = getpid();
+
+	return page;
+}
+
+void status_page_close(status_page_t *page)
+{
+	if (!page) {
+		return;
+	}
+	page->pid = 0;
+	munmap(page, sizeof(status_page_t));
+}
+
+void status_page_write(status_page_t *page, const status_page_t *state)
+{
+	uint32_t sequence = __atomic_load_n(&page->sequence, __ATOMIC_RELAXED);
+
+	/* readers seeing the odd value or a changed one retry */
+	__atomic_store_n(&page->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy((char *) page + STATUS_PAGE_DATA, (const char *) state + STATUS_PAGE_DATA,
+	       sizeof(status_page_t) - STATUS_PAGE_DATA);
+	__atomic_store_n(&page->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+int status_page_read(const char *path, status_page_t *state)
+{
+	const status_page_t *page;
+	uint32_t before;
+	uint32_t after;
+	struct stat st;
+	int retries;
+	int fd;
+	int r = 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -errno;
+	}
+	if (fstat(fd, &st) < 0) {
+		r = -errno;
+		close(fd);
+		return r;
+	}
+	/* pages written by older daemons are shorter */
+	if (st.st_size < (off_t) sizeof(status_page_t)) {
+		close(fd);
+		return -EPROTO;
+	}
+	page = mmap(NULL, sizeof(status_page_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		return -errno;
+	}
+	if (page->magic != STATUS_PAGE_MAGIC) {
+		r = -EPROTO;
+		goto finish;
+	}
+
+	for (retries = 0; retries < STATUS_READ_RETRIES; retries++) {
+		before = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+		if (before & 1) {
+			sched_yield();
+			continue;
+		}
+		memcpy(state, page, sizeof(status_page_t));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&page->sequence, __ATOMIC_RELAXED);
+		if (before == after) {
+			goto finish;
+		}
+	}
+	r = -EBUSY;
+
+finish:
+	munmap((void *) page, sizeof(status_page_t));
+	return r;
+}
@@ -0,0 +1,78 @@
+/*
+ * Daemon for controlling Clear Linux Software Update Client
+ *
+ * Copyright (C) 2016 Intel Corporation
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 2 or later of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: Dmitry Rozhkov <dmitry.rozhkov@intel.com>
+ *
+ */
+
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdint.h>
+
+/* Page the daemon publishes its state in, for processes to read without
+ * talking to it */
+#define STATUS_PAGE_PATH "/run/swupdd/status"
+
+#define STATUS_PAGE_MAGIC 0x50445753 /* "SWDP" */
+#define STATUS_PAGE_VERSION 1
+
+/* Layout of the page, fields are only ever added at the end */
+typedef struct _status_page {
+	uint32_t magic;
+	uint32_t version;
+	/* odd while the daemon writes, readers retry until they see the
+	 * same even value before and after reading */
+	uint32_t sequence;
+	/* pid of the daemon, 0 once it exited */
+	uint32_t pid;
+	/* CLOCK_REALTIME time of the last update */
+	uint64_t updated;
+	/* job started first among the running ones, 0 if there is none */
+	uint64_t job_id;
+	char method[16];
+	char phase[16];
+	uint32_t percent;
+	uint32_t running;
+	uint32_t queued;
+	/* outcome of the last job completed */
+	int32_t last_status;
+	char last_method[16];
+	uint64_t last_completed;
+	/* versions and results as in the properties of the Client object */
+	uint32_t installed_version;
+	uint32_t available_version;
+	uint32_t staged_version;
+	int32_t check_status;
+	uint64_t check_time;
+	uint64_t update_time;
+} status_page_t;
+
+/* Creates or reuses the page at path and maps it for writing, returns
+ * NULL on failure */
+status_page_t *status_page_open(const char *path);
+/* Marks the daemon gone and unmaps the page */
+void status_page_close(status_page_t *page);
+
+/* Publishes a snapshot of the state, header fields of state are
+ * ignored */
+void status_page_write(status_page_t *page, const status_page_t *state);
+
+/* Reads a consistent snapshot of the page at path */
+int status_page_read(const char *path, status_page_t *state);
+
+#endif /* STATUS_H */
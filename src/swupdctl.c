@@ -32,6 +32,7 @@ int verify_main(int argc, char **argv);
 int update_main(int argc, char **argv);
 int check_update_main(int argc, char **argv);
 int search_main(int argc, char **argv);
+int status_main(int argc, char **argv);
 
 struct subcmd {
 	char *name;
@@ -60,6 +61,7 @@ static struct subcmd commands[] = {
 	{ "verify", "Verify content for OS version", verify_main},
 	{ "check-update", "Checks if a new OS version is available", check_update_main},
 	{ "search", "Search Clear Linux for a binary or library", search_main},
+	{ "status", "Show the state of the daemon", status_main},
 	{ 0 }
 };
 
@@ -27,44 +27,144 @@
 #include <stdbool.h>
 #include <errno.h>
 #include <limits.h>
+#include <inttypes.h>
+#include <stddef.h>
 #include <assert.h>
+#include <ctype.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <grp.h>
 #include <systemd/sd-bus.h>
+#include <systemd/sd-id128.h>
 #include <systemd/sd-daemon.h>
 
 #include "log.h"
 #include "list.h"
+#include "config.h"
+#include "job.h"
+#include "child.h"
+#include "staging.h"
+#include "osinfo.h"
+#include "peer.h"
+#include "status.h"
+#include "idle.h"
 
 #define SWUPD_CLIENT    "swupd"
-#define TIMEOUT_EXIT_SEC 30
-
-typedef enum {
-	METHOD_NOTSET = 0,
-	METHOD_CHECK_UPDATE,
-	METHOD_UPDATE,
-	METHOD_VERIFY,
-	METHOD_BUNDLE_ADD,
-	METHOD_BUNDLE_REMOVE,
-	METHOD_HASH_DUMP,
-	METHOD_SEARCH
-} method_t;
+/* Jobs are exposed as objects below this path, named after their id */
+#define JOB_OBJECT_PATH "/org/O1/swupdd/Job"
+#define JOB_INTERFACE "org.O1.swupdd.Job"
+#define JOB_PATH_MAX (sizeof(JOB_OBJECT_PATH "/") + 20)
+/* bytes of child output read at once */
+#define OUTPUT_READ_SIZE (64 * 1024)
+#define ERROR_READ_SIZE 4096
+/* Forwarding output yields to method calls, so that a chatty child doesn't
+ * hold up Cancel */
+#define OUTPUT_PRIORITY (SD_EVENT_PRIORITY_NORMAL + 10)
+/* staged files measured per event loop iteration */
+#define STAGING_SCAN_BATCH 256
+
+/* Groups of properties of the Client object changes are collected for */
+#define CHANGED_STAGING (1 << 0)
+#define CHANGED_JOBS (1 << 1)
+#define CHANGED_OS (1 << 2)
 
 typedef struct _daemon_state {
 	sd_bus *bus;
-	pid_t child;
-	method_t method;
+	sd_event *event;
+	daemon_config_t config;
+	/* swupd executable resolved at startup */
+	char *swupd_path;
+	int swupd_fd;
+	job_queue_t queue;
+	/* jobs swupd is currently running for */
+	struct list *running;
+	/* jobs whose output is kept after they finished, most recently
+	 * read first */
+	struct list *finished;
+	/* job being completed, it is still on the bus while it's reported */
+	job_t *completing;
+	uint64_t last_job_id;
+	/* fires when a queued job waiting for its time becomes ready */
+	sd_event_source *dispatch_timer;
+	/* samples the host's load while there are background jobs */
+	sd_event_source *pressure_timer;
+	/* the host is too busy for background jobs, since when */
+	bool pressure_busy;
+	uint64_t pressure_busy_since;
+	/* periodic maintenance runs */
+	schedule_t schedule;
+	sd_event_source *schedule_timer;
+	/* a run that couldn't be submitted is retried no earlier than this */
+	time_t schedule_retry;
+	/* content downloaded ahead of an update */
+	staging_t staging;
+	/* measurement of a download just finished, taken in steps whenever
+	 * the event loop has nothing else to do */
+	staging_scan_t staging_scan;
+	sd_event_source *staging_source;
+	/* versions and results of checks and updates of the OS */
+	osinfo_t os;
+	/* CHANGED_* mask of properties PropertiesChanged is due for, emitted
+	 * once the event loop has nothing else to do */
+	unsigned int changed;
+	sd_event_source *changed_source;
+	/* state published for readers not talking to the daemon, NULL if
+	 * the page couldn't be created */
+	status_page_t *status_page;
+	/* outcome of the last job completed, for the page */
+	method_t last_method;
+	int last_status;
+	uint64_t last_completed;
+	/* when to exit while idle, and how the daemon got started */
+	idle_t idle;
+	/* time this start took up to being ready */
+	uint64_t startup_usec;
+	/* flushes output buffered for too long */
+	sd_event_source *output_timer;
+	/* reports progress held back by the rate limit */
+	sd_event_source *progress_timer;
+	/* child output is not read until the bus's write queue drains */
+	bool output_stalled;
+	sd_event_source *drain_source;
+	/* CLOCK_MONOTONIC time of the last stall */
+	uint64_t stalled_at;
+	/* metrics of the write queue */
+	uint64_t queue_peak;
+	uint64_t stalls;
+	uint64_t stall_usec;
+	/* clients getting the signals of all jobs rather than of their own,
+	 * error monitors don't get anything of stdout */
+	sd_bus_track *monitors;
+	sd_bus_track *error_monitors;
+	/* listening socket for direct connections, -1 if there is none */
+	int peer_fd;
+	sd_event_source *peer_source;
+	/* group allowed to connect directly, (gid_t) -1 for everyone */
+	gid_t peer_group;
+	/* server id the peers see */
+	sd_id128_t peer_server_id;
+	/* peer_t entries of clients connected directly */
+	struct list *peers;
+	uint64_t last_peer_id;
 } daemon_state_t;
 
-static const char * const _method_str_map[] = {
-	NULL,
-	"CheckUpdate",
-	"Update",
-	"Verify",
-	"BundleAdd",
-	"BundleRemove",
-	"HashDump",
-	"Search"
+/* Client connected over the direct socket rather than the bus */
+typedef struct _peer {
+	sd_bus *bus;
+	/* stands in for the unique bus name callers are known by, it
+	 * can't be mistaken for one */
+	char *name;
+} peer_t;
+
+/* Budget of downloads nobody is waiting for */
+static const scope_budget_t _predownload_budget = {
+	.cpu_weight = 10,
+	.io_weight = 10,
+	.nice = 19,
+	.io_class = SCOPE_IO_CLASS_IDLE
 };
 
 static const char * const _method_opt_map[] = {
@@ -84,6 +184,9 @@ static char **list_to_strv(struct list *strlist)
 	char **temp;
 
 	strv = (char **)calloc((list_len(strlist) + 1), sizeof(char *));
+	if (!strv) {
+		return NULL;
+	}
 
 	temp = strv;
 	while (strlist)
@@ -226,13 +329,276 @@ static int bus_message_read_option_int(sd_bus_message *m,
 	return 0;
 }
 
+static int bus_message_read_variant(sd_bus_message *m,
+				    const char *optname,
+				    char type,
+				    void *value,
+				    sd_bus_error *error)
+{
+	char contents[2] = { type, '\0' };
+	int r;
+
+	r = sd_bus_message_enter_container(m, SD_BUS_TYPE_VARIANT, contents);
+	if (r < 0) {
+		sd_bus_error_set_errnof(error, -r, "Failed to enter variant container of '%s'", optname);
+		return r;
+	}
+	r = sd_bus_message_read_basic(m, type, value);
+	if (r < 0) {
+		sd_bus_error_set_errnof(error, -r, "Can't read value of '%s'", optname);
+		return r;
+	}
+	r = sd_bus_message_exit_container(m);
+	if (r < 0) {
+		sd_bus_error_set_errnof(error, -r, "Can't exit variant container of '%s'", optname);
+		return r;
+	}
+
+	return 0;
+}
+
+/* Options controlling how the daemon handles a request, as opposed to the
+ * ones passed through to swupd */
+static char const * const _job_opts[] = {"priority", "cpu-weight", "io-weight", "memory-high",
+					  "nice", "io-class", "output-fd", "streams", "match", "regex",
+					  "severity", "wait", NULL};
+
+/* Takes a copy of a descriptor passed by the caller for the child's stdout */
+static int bus_message_read_output_fd(sd_bus_message *m,
+				      job_t *job,
+				      sd_bus_error *error)
+{
+	int flags;
+	int fd;
+	int r;
+
+	r = bus_message_read_variant(m, "output-fd", SD_BUS_TYPE_UNIX_FD, &fd, error);
+	if (r < 0) {
+		return r;
+	}
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0) {
+		sd_bus_error_set_errnof(error, errno, "Can't get flags of 'output-fd'");
+		return -errno;
+	}
+	if ((flags & O_ACCMODE) == O_RDONLY) {
+		sd_bus_error_set_errnof(error, EBADF, "'output-fd' is not open for writing");
+		return -EBADF;
+	}
+
+	/* the descriptor belongs to the message */
+	fd = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+	if (fd < 0) {
+		sd_bus_error_set_errnof(error, errno, "Can't duplicate 'output-fd'");
+		return -errno;
+	}
+	/* swupd isn't prepared for EAGAIN on its stdout */
+	if (flags & O_NONBLOCK) {
+		fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+	}
+
+	if (job->output_sink >= 0) {
+		close(job->output_sink);
+	}
+	job->output_sink = fd;
+
+	return 0;
+}
+
+/* Filters restrict the output a caller gets to the lines matching any of
+ * the fixed strings given with "match", the regular expression given with
+ * "regex" or the severity given with "severity" */
+static int bus_message_read_filter_option(sd_bus_message *m,
+					  const char *optname,
+					  job_t *job,
+					  sd_bus_error *error)
+{
+	filter_severity_t severity;
+	const char *value;
+	char **strings = NULL;
+	char **str;
+	int r;
+
+	if (!job->filter) {
+		job->filter = filter_new();
+		if (!job->filter) {
+			sd_bus_error_set_errnof(error, ENOMEM, "Can't allocate memory for filter");
+			return -ENOMEM;
+		}
+	}
+
+	if (strcmp(optname, "match") == 0) {
+		r = sd_bus_message_enter_container(m, SD_BUS_TYPE_VARIANT, "as");
+		if (r < 0) {
+			sd_bus_error_set_errnof(error, -r, "Failed to enter variant container of '%s'", optname);
+			return r;
+		}
+		r = sd_bus_message_read_strv(m, &strings);
+		if (r < 0) {
+			sd_bus_error_set_errnof(error, -r, "Can't read value of '%s'", optname);
+			return r;
+		}
+		for (str = strings; str && *str; str++) {
+			if (r >= 0) {
+				r = filter_add_string(job->filter, *str);
+			}
+			free(*str);
+		}
+		free(strings);
+		if (r < 0) {
+			sd_bus_error_set_errnof(error, -r, r == -EINVAL ? "Can't match empty strings" :
+						"Can't allocate memory for filter");
+			return r;
+		}
+		r = sd_bus_message_exit_container(m);
+		if (r < 0) {
+			sd_bus_error_set_errnof(error, -r, "Can't exit variant container of '%s'", optname);
+		}
+		return r;
+	}
+
+	r = bus_message_read_variant(m, optname, SD_BUS_TYPE_STRING, &value, error);
+	if (r < 0) {
+		return r;
+	}
+	if (strcmp(optname, "regex") == 0) {
+		r = filter_set_regex(job->filter, value);
+		if (r < 0) {
+			sd_bus_error_set_errnof(error, -r, "Invalid regular expression '%s'", value);
+			return r;
+		}
+	} else {
+		severity = filter_severity_from_name(value);
+		if (!severity) {
+			sd_bus_error_set_errnof(error, EINVAL, "Unknown severity '%s'", value);
+			return -EINVAL;
+		}
+		filter_set_severity(job->filter, severity);
+	}
+
+	return 0;
+}
+
+static int bus_message_read_job_option(sd_bus_message *m,
+				       const char *optname,
+				       job_t *job,
+				       sd_bus_error *error)
+{
+	const char *value;
+	int r;
+
+	if (strcmp(optname, "priority") == 0) {
+		r = bus_message_read_variant(m, optname, SD_BUS_TYPE_STRING, &value, error);
+		if (r < 0) {
+			return r;
+		}
+		if (strcmp(value, "interactive") == 0) {
+			job->priority = JOB_PRIORITY_INTERACTIVE;
+		} else if (strcmp(value, "background") == 0) {
+			job->priority = JOB_PRIORITY_BACKGROUND;
+		} else {
+			sd_bus_error_set_errnof(error, EINVAL, "Unknown priority class '%s'", value);
+			return -EINVAL;
+		}
+	} else if (strcmp(optname, "cpu-weight") == 0 || strcmp(optname, "io-weight") == 0) {
+		uint64_t *weight = optname[0] == 'c' ? &job->budget.cpu_weight : &job->budget.io_weight;
+
+		r = bus_message_read_variant(m, optname, SD_BUS_TYPE_UINT64, weight, error);
+		if (r < 0) {
+			return r;
+		}
+		if (*weight < 1 || *weight > 10000) {
+			sd_bus_error_set_errnof(error, EINVAL, "'%s' must be between 1 and 10000", optname);
+			return -EINVAL;
+		}
+	} else if (strcmp(optname, "memory-high") == 0) {
+		return bus_message_read_variant(m, optname, SD_BUS_TYPE_UINT64, &job->budget.memory_high, error);
+	} else if (strcmp(optname, "nice") == 0) {
+		r = bus_message_read_variant(m, optname, SD_BUS_TYPE_INT32, &job->budget.nice, error);
+		if (r < 0) {
+			return r;
+		}
+		if (job->budget.nice < -20 || job->budget.nice > 19) {
+			sd_bus_error_set_errnof(error, EINVAL, "'nice' must be between -20 and 19");
+			return -EINVAL;
+		}
+	} else if (strcmp(optname, "output-fd") == 0) {
+		return bus_message_read_output_fd(m, job, error);
+	} else if (strcmp(optname, "match") == 0 || strcmp(optname, "regex") == 0 ||
+		   strcmp(optname, "severity") == 0) {
+		return bus_message_read_filter_option(m, optname, job, error);
+	} else if (strcmp(optname, "streams") == 0) {
+		r = bus_message_read_variant(m, optname, SD_BUS_TYPE_STRING, &value, error);
+		if (r < 0) {
+			return r;
+		}
+		if (strcmp(value, "all") == 0) {
+			job->streams = JOB_STREAM_ALL;
+		} else if (strcmp(value, "stdout") == 0) {
+			job->streams = JOB_STREAM_STDOUT;
+		} else if (strcmp(value, "stderr") == 0) {
+			job->streams = JOB_STREAM_STDERR;
+		} else {
+			sd_bus_error_set_errnof(error, EINVAL, "Unknown output stream '%s'", value);
+			return -EINVAL;
+		}
+	} else if (strcmp(optname, "wait") == 0) {
+		int wait;
+
+		r = bus_message_read_variant(m, optname, SD_BUS_TYPE_BOOLEAN, &wait, error);
+		if (r < 0) {
+			return r;
+		}
+		job->wait = wait;
+	} else if (strcmp(optname, "io-class") == 0) {
+		r = bus_message_read_variant(m, optname, SD_BUS_TYPE_STRING, &value, error);
+		if (r < 0) {
+			return r;
+		}
+		job->budget.io_class = scope_io_class_from_name(value);
+		if (!job->budget.io_class) {
+			sd_bus_error_set_errnof(error, EINVAL, "Unknown I/O scheduling class '%s'", value);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static void free_option_args(void *data)
+{
+	list_free_list_and_data(data, free);
+}
+
+/* Orders options by name and value, so that requests differing only in the
+ * order of their options end up with identical command lines */
+static int compare_option_args(const void *a, const void *b)
+{
+	const struct list *args_a = a;
+	const struct list *args_b = b;
+	int r;
+
+	r = strcmp(args_a->data, args_b->data);
+	if (r != 0) {
+		return r;
+	}
+	if (!args_a->next || !args_b->next) {
+		return !!args_a->next - !!args_b->next;
+	}
+	return strcmp(args_a->next->data, args_b->next->data);
+}
+
 static int bus_message_read_options(sd_bus_message *m,
 	                            char const * const opts_str[],
 	                            char const * const opts_bool[],
 				    char const * const opts_int[],
-				    struct list **strlist,
+				    job_t *job,
 				    sd_bus_error *error)
 {
+	/* command line arguments of each option */
+	struct list *options = NULL;
+	struct list *item;
 	int r;
 
 	r = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "{sv}");
@@ -243,48 +609,60 @@ static int bus_message_read_options(sd_bus_message *m,
 
 	while ((r = sd_bus_message_enter_container(m, SD_BUS_TYPE_DICT_ENTRY, "sv")) > 0) {
                 const char *argname;
+		struct list *optargs = NULL;
 
                 r = sd_bus_message_read(m, "s", &argname);
                 if (r < 0) {
 			sd_bus_error_set_errnof(error, -r, "Can't read option name");
-                        return r;
+                        goto finish;
 		}
 		if (is_in_array(argname, opts_str)) {
-			r = bus_message_read_option_string(m, argname, strlist, error);
-			if (r < 0) {
-				return r;
-			}
+			r = bus_message_read_option_string(m, argname, &optargs, error);
 		} else if (is_in_array(argname, opts_bool)) {
-			r = bus_message_read_option_bool(m, argname, strlist, error);
-			if (r < 0) {
-				return r;
-			}
+			r = bus_message_read_option_bool(m, argname, &optargs, error);
 		} else if (is_in_array(argname, opts_int)) {
-			r = bus_message_read_option_int(m, argname, strlist, error);
-			if (r < 0) {
-				return r;
-			}
+			r = bus_message_read_option_int(m, argname, &optargs, error);
+		} else if (is_in_array(argname, _job_opts)) {
+			r = bus_message_read_job_option(m, argname, job, error);
 		} else {
 			r = sd_bus_message_skip(m, "v");
 			if (r < 0) {
 				sd_bus_error_set_errnof(error, -r, "Can't skip unwanted option value");
-				return r;
 			}
 		}
+		if (optargs) {
+			options = list_append_data(options, list_head(optargs));
+		}
+		if (r < 0) {
+			goto finish;
+		}
 
                 r = sd_bus_message_exit_container(m);
                 if (r < 0) {
 			sd_bus_error_set_errnof(error, -r, "Can't exit dict entry container");
-                        return r;
+                        goto finish;
 		}
 	}
+	if (r < 0) {
+		sd_bus_error_set_errnof(error, -r, "Can't enter dict entry container");
+		goto finish;
+	}
 	r = sd_bus_message_exit_container(m);
 	if (r < 0) {
 		sd_bus_error_set_errnof(error, -r, "Can't exit options container");
-		return r;
+		goto finish;
 	}
 
+	options = list_sort(options, compare_option_args);
+	for (item = options; item; item = item->next) {
+		job->args = list_tail(list_concat(job->args, item->data));
+	}
+	list_free_list(options);
 	return 0;
+
+finish:
+	list_free_list_and_data(options, free_option_args);
+	return r;
 }
 
 static int on_name_owner_change(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
@@ -299,198 +677,2171 @@ static int on_name_owner_change(sd_bus_message *m, void *userdata, sd_bus_error
 	return 1;
 }
 
-static int on_childs_output(sd_event_source *s, int fd, uint32_t revents, void *userdata)
+/* Sees every message before it's dispatched, requests keep the daemon
+ * around for the ones to follow */
+static int on_incoming_message(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
 {
 	daemon_state_t *context = userdata;
-	int r = 0;
-	char buffer[PIPE_BUF + 1];
-	ssize_t count;
-
-	while ((count = read(fd, buffer, PIPE_BUF)) < 0 && (errno == EINTR)) {}
-	if (count > 0) {
-		buffer[count] = '\0';
-		r = sd_bus_emit_signal(context->bus,
-				       "/org/O1/swupdd/Client",
-				       "org.O1.swupdd.Client",
-				       "ChildOutputReceived", "s", buffer);
-		if (r < 0) {
-			ERR("Failed to emit signal: %s", strerror(-r));
-		}
+	uint64_t now;
 
-		return 0;
-	} else if (count < 0) {
-		ERR("Failed to read pipe: %s", strerror(errno));
-		/* Disable the handler since the pipe is broken */
-		r = -1;
+	if (sd_bus_message_is_method_call(m, NULL, NULL) > 0) {
+		sd_event_now(context->event, CLOCK_REALTIME, &now);
+		idle_note_request(&context->idle, now);
 	}
 
-	/* No more events for this handler are expected */
-	close(fd);
-	sd_event_source_unref(s);
-	return r;
+	return 0;
 }
 
-static int on_child_exit(sd_event_source *s, const struct signalfd_siginfo *si, void *userdata)
+static job_t *find_running_job(daemon_state_t *context, pid_t pid, int output_fd)
 {
-	daemon_state_t *context = userdata;
-	int child_exit_status;
-	int status = 0;
-	int r;
+	struct list *item;
 
-	method_t child_method = context->method;
-	assert(child_method);
+	for (item = list_head(context->running); item; item = item->next) {
+		job_t *job = item->data;
 
-	if (si->ssi_code == CLD_EXITED) {
-		status = si->ssi_status;
-	} else {
-		DEBUG("Child process was killed");
-		/* si->ssi_status is signal code in this case */
-		status = 128 + si->ssi_status;
-	}
-
-	/* Reap the zomby */
-	assert(si->ssi_pid == context->child);
-	pid_t ws = waitpid(si->ssi_pid, &child_exit_status, 0);
-	assert(ws != -1);
-
-	context->child = 0;
-	context->method = METHOD_NOTSET;
-
-	r = sd_bus_emit_signal(context->bus,
-			       "/org/O1/swupdd/Client",
-			       "org.O1.swupdd.Client",
-			       "RequestCompleted", "si", _method_str_map[child_method], status);
-	if (r < 0) {
-		ERR("Can't emit D-Bus signal: %s", strerror(-r));
+		if ((pid > 0 && !job->exited && job->pid == pid) ||
+		    (output_fd >= 0 && (job->output_fd == output_fd || job->error_fd == output_fd))) {
+			return job;
+		}
 	}
 
-	return 0;
+	return NULL;
 }
 
-static int run_swupd(method_t method, struct list *args, daemon_state_t *context)
-{
-	pid_t pid;
-	int fds[2];
-	int r;
+static void finish_job(daemon_state_t *context, job_t *job);
+static void publish_status(daemon_state_t *context);
 
-	r = pipe2(fds, O_DIRECT);
-	if (r < 0) {
-		ERR("Can't create pipe: %s", strerror(errno));
-		return -errno;
-	}
+static peer_t *find_peer(daemon_state_t *context, sd_bus *bus, const char *name)
+{
+	struct list *item;
 
-	pid = fork();
+	for (item = list_head(context->peers); item; item = item->next) {
+		peer_t *peer = item->data;
 
-	if (pid == 0) { /* child */
-		dup2(STDOUT_FILENO, STDERR_FILENO);
-		while ((dup2(fds[1], STDOUT_FILENO) == -1) && (errno == EINTR)) {}
-		close(fds[1]);
-		close(fds[0]);
-		char **argv = list_to_strv(list_head(args));
-		execvp(*argv, argv);
-		ERR("This line must not be reached");
-		_exit(1);
-	} else if (pid < 0) {
-		ERR("Failed to fork: %s", strerror(errno));
-		close(fds[1]);
-		close(fds[0]);
-		return -errno;
+		if (peer->bus == bus || (name && strcmp(peer->name, name) == 0)) {
+			return peer;
+		}
 	}
 
-	close(fds[1]);
-	context->child = pid;
-	context->method = method;
-	sd_event *event = NULL;
-	r = sd_event_default(&event);
-	r = sd_event_add_io(event, NULL, fds[0], EPOLLIN, on_childs_output, context);
-	assert(r >= 0);
-	sd_event_unref(event);
-
-	return 0;
+	return NULL;
 }
 
-static int check_prerequisites(daemon_state_t *context, sd_bus_error *error)
+/* Returns the name the sender of a request is known by, be it on the bus
+ * or connected directly */
+static const char *request_sender(daemon_state_t *context, sd_bus_message *m)
 {
-	if (context->child) {
-		sd_bus_error_set_errnof(error, EAGAIN, "Busy with ongoing request to swupd");
-		return -EAGAIN;
+	sd_bus *bus = sd_bus_message_get_bus(m);
+	peer_t *peer;
+
+	if (bus == context->bus) {
+		return sd_bus_message_get_sender(m);
 	}
+	peer = find_peer(context, bus, NULL);
 
-	return 0;
+	return peer ? peer->name : NULL;
 }
 
-static int method_update(sd_bus_message *m,
-	                 void *userdata,
-	                 sd_bus_error *ret_error)
+/* Appends the arguments of a signal */
+typedef int (*signal_append_t)(sd_bus_message *m, const void *data);
+
+static int send_signal_to(daemon_state_t *context,
+			  const char *destination,
+			  const char *member,
+			  signal_append_t append,
+			  const void *data)
 {
-	daemon_state_t *context = userdata;
-	int r = 0;
-	struct list *args = NULL;
+	peer_t *peer = find_peer(context, NULL, destination);
+	sd_bus *bus = peer ? peer->bus : context->bus;
+	sd_bus_message *m = NULL;
+	int r;
 
-	r = check_prerequisites(context, ret_error);
-	if (r < 0) {
-		return r;
+	/* names of peers are no unique bus names, the peer is gone */
+	if (!peer && *destination != ':') {
+		return 0;
 	}
 
-	args = list_append_data(args, strdup(SWUPD_CLIENT));
-	args = list_append_data(args, strdup(_method_opt_map[METHOD_UPDATE]));
-
-	char const * const str_opts[] = {"url", "contenturl", "versionurl",
-					 "format", "statedir", "path", NULL};
-	char const * const bool_opts[] = {"download", "status", "force", NULL};
-	char const * const int_opts[] = {"port", NULL};
-	r = bus_message_read_options(m, str_opts, bool_opts, int_opts, &args, ret_error);
+	r = sd_bus_message_new_signal(bus, &m,
+				      "/org/O1/swupdd/Client",
+				      "org.O1.swupdd.Client",
+				      member);
 	if (r < 0) {
 		goto finish;
 	}
-
-	r  = run_swupd(METHOD_UPDATE, args, context);
+	/* a direct connection has nobody else to route the signal to */
+	if (!peer) {
+		r = sd_bus_message_set_destination(m, destination);
+		if (r < 0) {
+			goto finish;
+		}
+	}
+	r = append(m, data);
 	if (r < 0) {
-		sd_bus_error_set_errnof(ret_error, -r, "Failed to run swupd command");
 		goto finish;
 	}
-
-	r = sd_bus_reply_method_return(m, "b", (r >= 0));
+	r = sd_bus_send(bus, m, NULL);
 
 finish:
-	list_free_list_and_data(args, free);
+	sd_bus_message_unref(m);
 	return r;
 }
 
-static int method_verify(sd_bus_message *m,
-	                 void *userdata,
-	                 sd_bus_error *ret_error)
+/* Returns true if the caller is the first one of the job with its name,
+ * a client submitting the same request twice gets a single copy of each
+ * signal. Jobs the daemon started on its own have callers without name. */
+static bool is_signal_recipient(job_t *job, job_caller_t *caller)
 {
-	daemon_state_t *context = userdata;
-	int r = 0;
-	struct list *args = NULL;
-
-	r = check_prerequisites(context, ret_error);
-	if (r < 0) {
-		return r;
-	}
+	return *caller->name && job_find_caller(job, caller->name) == caller;
+}
 
-	args = list_append_data(args, strdup(SWUPD_CLIENT));
-	args = list_append_data(args, strdup(_method_opt_map[METHOD_VERIFY]));
+static bool is_monitor(daemon_state_t *context, const char *name)
+{
+	return sd_bus_track_contains(context->monitors, name) ||
+		sd_bus_track_contains(context->error_monitors, name);
+}
 
-	char const * const str_opts[] = {"path", "url", "contenturl", "versionurl",
-					 "format", "statedir", NULL};
-	char const * const bool_opts[] = {"fix", "install", "quick", "force", NULL};
-	char const * const int_opts[] = {"manifest", "port", NULL};
-	r = bus_message_read_options(m, str_opts, bool_opts, int_opts, &args, ret_error);
-	if (r < 0) {
-		goto finish;
-	}
+/* Sends a signal to the monitors that aren't callers of the job. Signals
+ * of a single stream only go to the monitors interested in it, the ones
+ * not about output have JOB_STREAM_ALL. */
+static int send_monitor_signal(daemon_state_t *context,
+			       job_t *job,
+			       unsigned int stream,
+			       const char *member,
+			       signal_append_t append,
+			       const void *data)
+{
+	sd_bus_track *tracks[] = { context->monitors, context->error_monitors };
+	unsigned int streams[] = { JOB_STREAM_ALL, JOB_STREAM_STDERR };
+	const char *monitor;
+	size_t i;
+	int ret = 0;
+	int r;
 
-	r  = run_swupd(METHOD_VERIFY, args, context);
-	if (r < 0) {
-		sd_bus_error_set_errnof(ret_error, -r, "Failed to run swupd command");
+	for (i = 0; i < sizeof(tracks) / sizeof(tracks[0]); i++) {
+		if (!(streams[i] & stream)) {
+			continue;
+		}
+		for (monitor = sd_bus_track_first(tracks[i]); monitor;
+		     monitor = sd_bus_track_next(tracks[i])) {
+			if (job_find_caller(job, monitor)) {
+				continue;
+			}
+			r = send_signal_to(context, monitor, member, append, data);
+			if (r < 0) {
+				ret = r;
+			}
+		}
 	}
 
-	r = sd_bus_reply_method_return(m, "b", (r >= 0));
+	return ret;
+}
+
+/* Sends a signal on a job to its callers and to monitors, rather than
+ * waking up every process listening on the bus */
+static int send_job_signal(daemon_state_t *context,
+			   job_t *job,
+			   unsigned int stream,
+			   const char *member,
+			   signal_append_t append,
+			   const void *data)
+{
+	struct list *item;
+	int ret = 0;
+	int r;
+
+	for (item = list_head(job->callers); item; item = item->next) {
+		job_caller_t *caller = item->data;
+
+		/* output for callers with a filter is sent separately */
+		if (is_signal_recipient(job, caller) && (caller->streams & stream) &&
+		    (stream == JOB_STREAM_ALL || !caller->filter)) {
+			r = send_signal_to(context, caller->name, member, append, data);
+			if (r < 0) {
+				ret = r;
+			}
+		}
+	}
+
+	r = send_monitor_signal(context, job, stream, member, append, data);
+
+	return r < 0 ? r : ret;
+}
+
+/* Returns the longest write queue of the bus and the direct connections,
+ * output is forwarded as fast as the slowest client takes it */
+static int get_queued_writes(daemon_state_t *context, uint64_t *ret)
+{
+	struct list *item;
+	uint64_t queued;
+	int r;
+
+	r = sd_bus_get_n_queued_write(context->bus, ret);
+	if (r < 0) {
+		return r;
+	}
+	for (item = list_head(context->peers); item; item = item->next) {
+		peer_t *peer = item->data;
+
+		if (sd_bus_get_n_queued_write(peer->bus, &queued) >= 0 && queued > *ret) {
+			*ret = queued;
+		}
+	}
+
+	return 0;
+}
+
+static void set_output_enabled(daemon_state_t *context, bool enabled)
+{
+	struct list *item;
+
+	for (item = list_head(context->running); item; item = item->next) {
+		job_t *job = item->data;
+
+		if (job->output_source) {
+			sd_event_source_set_enabled(job->output_source, enabled ? SD_EVENT_ON : SD_EVENT_OFF);
+		}
+		if (job->error_source) {
+			sd_event_source_set_enabled(job->error_source, enabled ? SD_EVENT_ON : SD_EVENT_OFF);
+		}
+	}
+}
+
+/* Runs after every iteration of the event loop while output is stalled,
+ * which includes the ones the bus gets to write in */
+static int on_output_drain(sd_event_source *s, void *userdata)
+{
+	daemon_state_t *context = userdata;
+	uint64_t queued;
+	uint64_t now;
+
+	if (get_queued_writes(context, &queued) >= 0 &&
+	    queued > context->config.output_queue_max / 2) {
+		return 0;
+	}
+
+	sd_event_now(context->event, CLOCK_MONOTONIC, &now);
+	context->stall_usec += now - context->stalled_at;
+	context->output_stalled = false;
+	set_output_enabled(context, true);
+	sd_event_source_set_enabled(s, SD_EVENT_OFF);
+	DEBUG("Bus caught up with output, resuming");
+
+	return 0;
+}
+
+/* Stops reading child output while too many messages wait to be written
+ * to the bus. Children then block on their output instead of the daemon
+ * growing its write queue without bound for slow clients. */
+static void check_output_backlog(daemon_state_t *context)
+{
+	uint64_t queued;
+	int r;
+
+	if (!context->config.output_queue_max || context->output_stalled ||
+	    get_queued_writes(context, &queued) < 0) {
+		return;
+	}
+	if (queued > context->queue_peak) {
+		context->queue_peak = queued;
+	}
+	if (queued < context->config.output_queue_max) {
+		return;
+	}
+
+	if (!context->drain_source) {
+		r = sd_event_add_post(context->event, &context->drain_source, on_output_drain, context);
+		if (r < 0) {
+			ERR("Failed to add drain handler: %s", strerror(-r));
+			return;
+		}
+	} else {
+		sd_event_source_set_enabled(context->drain_source, SD_EVENT_ON);
+	}
+
+	DEBUG("%" PRIu64 " messages queued for the bus, holding output back", queued);
+	sd_event_now(context->event, CLOCK_MONOTONIC, &context->stalled_at);
+	context->output_stalled = true;
+	context->stalls++;
+	set_output_enabled(context, false);
+}
+
+static int append_string(sd_bus_message *m, const void *data)
+{
+	return sd_bus_message_append_basic(m, SD_BUS_TYPE_STRING, data);
+}
+
+static int append_strv(sd_bus_message *m, const void *data)
+{
+	return sd_bus_message_append_strv(m, (char **) data);
+}
+
+/* Emits the text as an array of lines without their newlines, to the
+ * destination or to everyone getting the job's stdout unfiltered. The
+ * text gets split in place. */
+static int emit_output_lines(daemon_state_t *context,
+			     job_t *job,
+			     const char *destination,
+			     char *text,
+			     size_t len)
+{
+	char **lines;
+	char *line;
+	char *end;
+	size_t count = 0;
+	int r;
+
+	for (line = text; (end = memchr(line, '\n', text + len - line)); line = end + 1) {
+		count++;
+	}
+	if (line < text + len) {
+		count++;
+	}
+
+	lines = calloc(count + 1, sizeof(char *));
+	if (!lines) {
+		return -ENOMEM;
+	}
+	count = 0;
+	for (line = text; line < text + len; line = end + 1) {
+		end = memchr(line, '\n', text + len - line);
+		if (!end) {
+			end = text + len;
+		}
+		*end = '\0';
+		lines[count++] = line;
+	}
+
+	if (destination) {
+		r = send_signal_to(context, destination, "ChildOutputLines", append_strv, lines);
+	} else {
+		r = send_job_signal(context, job, JOB_STREAM_STDOUT, "ChildOutputLines", append_strv, lines);
+	}
+	free(lines);
+
+	return r;
+}
+
+/* Sends a chunk of output, NUL terminated at len, in the signal of its
+ * stream. The text may get split in place. */
+static int send_output(daemon_state_t *context,
+		       job_t *job,
+		       const char *destination,
+		       unsigned int stream,
+		       char *text,
+		       size_t len)
+{
+	const char *member = stream == JOB_STREAM_STDERR ? "ChildErrorReceived" : "ChildOutputReceived";
+
+	if (stream == JOB_STREAM_STDOUT && context->config.output_lines) {
+		return emit_output_lines(context, job, destination, text, len);
+	} else if (destination) {
+		return send_signal_to(context, destination, member, append_string, text);
+	}
+
+	return send_job_signal(context, job, stream, member, append_string, text);
+}
+
+/* Sends callers with a filter the lines of a chunk of output they asked
+ * for, if any. Last is set for the end of the output. */
+static int send_filtered_output(daemon_state_t *context,
+				job_t *job,
+				unsigned int stream,
+				const char *text,
+				size_t len,
+				bool last)
+{
+	struct list *item;
+	char *passed;
+	size_t passed_len;
+	int ret = 0;
+	int r;
+
+	for (item = list_head(job->callers); item; item = item->next) {
+		job_caller_t *caller = item->data;
+
+		if (!caller->filter || !(caller->streams & stream) ||
+		    !is_signal_recipient(job, caller)) {
+			continue;
+		}
+		passed = filter_apply(caller->filter, text, len, stream == JOB_STREAM_STDERR, last,
+				      &passed_len);
+		if (!passed) {
+			continue;
+		}
+		r = send_output(context, job, caller->name, stream, passed, passed_len);
+		if (r < 0) {
+			ret = r;
+		}
+		free(passed);
+	}
+
+	return ret;
+}
+
+typedef struct _progress_report {
+	job_t *job;
+	uint64_t now;
+} progress_report_t;
+
+static int append_progress(sd_bus_message *m, const void *data)
+{
+	const progress_report_t *report = data;
+	job_t *job = report->job;
+
+	return sd_bus_message_append(m, "tssuttt", job->id, job_method_name(job->method),
+				     progress_phase_name(job->progress.phase),
+				     job->progress.percent, job->progress.done, job->progress.total,
+				     progress_eta(&job->progress, report->now));
+}
+
+static int on_progress_timer(sd_event_source *s, uint64_t usec, void *userdata);
+
+static void arm_progress_timer(daemon_state_t *context, uint64_t when)
+{
+	int enabled = SD_EVENT_OFF;
+	uint64_t armed;
+	int r;
+
+	if (context->progress_timer) {
+		sd_event_source_get_enabled(context->progress_timer, &enabled);
+	}
+	if (enabled != SD_EVENT_OFF &&
+	    sd_event_source_get_time(context->progress_timer, &armed) >= 0 && armed <= when) {
+		return;
+	}
+
+	if (!context->progress_timer) {
+		r = sd_event_add_time(context->event, &context->progress_timer, CLOCK_MONOTONIC,
+				      when, 0, on_progress_timer, context);
+		if (r < 0) {
+			ERR("Failed to add progress timer: %s", strerror(-r));
+			return;
+		}
+		sd_event_source_set_priority(context->progress_timer, OUTPUT_PRIORITY);
+		return;
+	}
+	sd_event_source_set_time(context->progress_timer, when);
+	sd_event_source_set_enabled(context->progress_timer, SD_EVENT_ONESHOT);
+}
+
+/* Reports the progress of a job at most once per interval, except for
+ * the start of a new phase. Changes within the interval are reported when
+ * it is over. */
+static void report_progress(daemon_state_t *context, job_t *job, bool phase_changed)
+{
+	progress_report_t report = { job, 0 };
+	uint64_t interval = (uint64_t) context->config.progress_interval * 1000;
+	int r;
+
+	if (!job->progress.changed || !interval) {
+		return;
+	}
+
+	sd_event_now(context->event, CLOCK_MONOTONIC, &report.now);
+	if (!phase_changed && job->progress_sent_at &&
+	    report.now < job->progress_sent_at + interval) {
+		arm_progress_timer(context, job->progress_sent_at + interval);
+		return;
+	}
+
+	r = send_job_signal(context, job, JOB_STREAM_ALL, "Progress", append_progress, &report);
+	if (r < 0) {
+		ERR("Failed to emit signal: %s", strerror(-r));
+	}
+	job->progress.changed = false;
+	job->progress_sent_at = report.now;
+	publish_status(context);
+}
+
+static int on_progress_timer(sd_event_source *s, uint64_t usec, void *userdata)
+{
+	daemon_state_t *context = userdata;
+	struct list *item;
+
+	for (item = list_head(context->running); item; item = item->next) {
+		report_progress(context, item->data, false);
+	}
+
+	return 0;
+}
+
+/* Forwards buffered output of the job to clients in a single signal. In
+ * line-framed mode a partial line is held back until it is complete,
+ * unless it grows too long or no more output is to come. */
+static void flush_job_output(daemon_state_t *context, job_t *job, bool lines, bool all)
+{
+	bool framed = context->config.output_lines;
+	size_t len = job_output_flush_len(job, lines || framed, all);
+	char saved;
+	int r;
+
+	if (!len) {
+		return;
+	}
+	if (framed && !all && job->output[len - 1] != '\n' &&
+	    job->output_len < context->config.output_flush_size) {
+		return;
+	}
+
+	saved = job->output[len];
+	job->output[len] = '\0';
+
+	if (job->method == METHOD_BUNDLE_ADD || job->method == METHOD_BUNDLE_REMOVE) {
+		job_scan_bundle_output(job, job->output);
+	} else if (job->method == METHOD_CHECK_UPDATE) {
+		job_scan_version_output(job, job->output);
+	}
+	if (context->config.progress_interval) {
+		uint64_t now;
+
+		sd_event_now(context->event, CLOCK_MONOTONIC, &now);
+		report_progress(context, job, progress_scan(&job->progress, job->output, now));
+	}
+	/* filters go first, unfiltered lines get split in place */
+	r = send_filtered_output(context, job, JOB_STREAM_STDOUT, job->output, len, all);
+	if (r < 0) {
+		ERR("Failed to emit signal: %s", strerror(-r));
+	}
+	r = send_output(context, job, NULL, JOB_STREAM_STDOUT, job->output, len);
+	if (r < 0) {
+		ERR("Failed to emit signal: %s", strerror(-r));
+	} else {
+		job->output_signals++;
+	}
+	check_output_backlog(context);
+
+	job->output[len] = saved;
+	job_output_consume(job, len);
+}
+
+static int on_output_timer(sd_event_source *s, uint64_t usec, void *userdata)
+{
+	daemon_state_t *context = userdata;
+	struct list *item;
+
+	for (item = list_head(context->running); item; item = item->next) {
+		flush_job_output(context, item->data, false, false);
+	}
+
+	return 0;
+}
+
+/* Bounds the time output waits in the buffer for more to come */
+static void arm_output_timer(daemon_state_t *context)
+{
+	int enabled = SD_EVENT_OFF;
+	uint64_t now;
+	int r;
+
+	if (context->output_timer) {
+		sd_event_source_get_enabled(context->output_timer, &enabled);
+	}
+	if (enabled != SD_EVENT_OFF) {
+		return;
+	}
+
+	sd_event_now(context->event, CLOCK_MONOTONIC, &now);
+	now += (uint64_t) context->config.output_flush_interval * 1000;
+	if (!context->output_timer) {
+		r = sd_event_add_time(context->event, &context->output_timer, CLOCK_MONOTONIC,
+				      now, 0, on_output_timer, context);
+		if (r < 0) {
+			ERR("Failed to add output timer: %s", strerror(-r));
+			return;
+		}
+		sd_event_source_set_priority(context->output_timer, OUTPUT_PRIORITY);
+		return;
+	}
+	sd_event_source_set_time(context->output_timer, now);
+	sd_event_source_set_enabled(context->output_timer, SD_EVENT_ONESHOT);
+}
+
+/* Reads output there is no memory to buffer for forwarding. It is only
+ * kept in the history, closing the pipe instead would make swupd fail
+ * with EPIPE in the middle of its work. Returns what read() does. */
+static ssize_t drain_childs_output(job_t *job, int fd)
+{
+	static char scratch[OUTPUT_READ_SIZE];
+	ssize_t count;
+
+	while ((count = read(fd, scratch, sizeof(scratch))) < 0 && (errno == EINTR)) {}
+	if (count > 0) {
+		ERR("Out of memory, dropping %zd bytes of output of job %" PRIu64, count, job->id);
+		ring_append(&job->history, scratch, count);
+	}
+
+	return count;
+}
+
+/* Output is forwarded once enough of it has accumulated, once it has
+ * waited for the flush interval, or when the child closes its end. This
+ * saves the bus from a signal per line of chatty commands. */
+static int on_childs_output(sd_event_source *s, int fd, uint32_t revents, void *userdata)
+{
+	daemon_state_t *context = userdata;
+	job_t *job = find_running_job(context, 0, fd);
+	int r = 0;
+	char *buffer = NULL;
+	ssize_t count = 0;
+
+	if (job) {
+		buffer = job_output_reserve(job, OUTPUT_READ_SIZE);
+		if (!buffer && job->output_len) {
+			/* forwarding what is buffered makes room */
+			flush_job_output(context, job, false, true);
+			buffer = job_output_reserve(job, OUTPUT_READ_SIZE);
+		}
+		if (!buffer) {
+			count = drain_childs_output(job, fd);
+		} else {
+			while ((count = read(fd, buffer, OUTPUT_READ_SIZE)) < 0 && (errno == EINTR)) {}
+		}
+	}
+	if (count > 0 && !buffer) {
+		return 0;
+	} else if (count > 0) {
+		if (ring_append(&job->history, buffer, count) < 0) {
+			DEBUG("Can't keep output of job %" PRIu64, job->id);
+		}
+		job->output_len += count;
+		if (job->output_len >= context->config.output_flush_size ||
+		    !context->config.output_flush_interval) {
+			flush_job_output(context, job, context->config.output_flush_lines, false);
+		}
+		if (job->output_len) {
+			arm_output_timer(context);
+		}
+
+		return 0;
+	} else if (count < 0) {
+		ERR("Failed to read pipe: %s", strerror(errno));
+		/* Disable the handler since the pipe is broken */
+		r = -1;
+	}
+
+	/* No more events for this handler are expected */
+	close(fd);
+	sd_event_source_unref(s);
+
+	if (job) {
+		flush_job_output(context, job, false, true);
+		job->output_fd = -1;
+		job->output_source = NULL;
+		if (job->exited && job->error_fd < 0) {
+			finish_job(context, job);
+		}
+	}
+	return r;
+}
+
+/* Errors are few and wanted as soon as possible, so they are forwarded as
+ * they come rather than batched */
+static int on_childs_errors(sd_event_source *s, int fd, uint32_t revents, void *userdata)
+{
+	daemon_state_t *context = userdata;
+	job_t *job = find_running_job(context, 0, fd);
+	char buffer[ERROR_READ_SIZE + sizeof(job->error_carry) + 1];
+	ssize_t count = 0;
+	size_t carried = 0;
+	size_t len;
+	int r = 0;
+
+	if (job) {
+		carried = job->error_carry_len;
+		memcpy(buffer, job->error_carry, carried);
+		while ((count = read(fd, buffer + carried, ERROR_READ_SIZE)) < 0 && (errno == EINTR)) {}
+	}
+	if (count < 0) {
+		ERR("Failed to read pipe: %s", strerror(errno));
+		r = -1;
+	}
+
+	if (job) {
+		len = job_error_chunk(job, buffer, carried + (count > 0 ? count : 0), count <= 0);
+		if (len) {
+			buffer[len] = '\0';
+			if (job->method == METHOD_BUNDLE_ADD || job->method == METHOD_BUNDLE_REMOVE) {
+				job_scan_bundle_output(job, buffer);
+			}
+			if (send_filtered_output(context, job, JOB_STREAM_STDERR, buffer, len,
+						 count <= 0) < 0 ||
+			    send_output(context, job, NULL, JOB_STREAM_STDERR, buffer, len) < 0) {
+				ERR("Failed to emit signal");
+			}
+			check_output_backlog(context);
+		}
+	}
+	if (count > 0) {
+		return 0;
+	}
+
+	/* No more events for this handler are expected */
+	close(fd);
+	sd_event_source_unref(s);
+
+	if (job) {
+		job->error_fd = -1;
+		job->error_source = NULL;
+		if (job->exited && job->output_fd < 0) {
+			finish_job(context, job);
+		}
+	}
+	return r;
+}
+
+static uint64_t timeval_to_usec(const struct timeval *tv)
+{
+	return (uint64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static int append_job_details(sd_bus_message *m, daemon_state_t *context, job_t *job)
+{
+	int r;
+
+	/* Details on the resources the job was given and took, so that
+	 * budgets can be tuned */
+	r = sd_bus_message_open_container(m, SD_BUS_TYPE_ARRAY, "{sv}");
+	if (r < 0) {
+		return r;
+	}
+	r = sd_bus_message_append(m, "{sv}", "job-id", "t", job->id);
+	if (r < 0) {
+		return r;
+	}
+	r = scope_budget_append(m, &job->budget);
+	if (r < 0) {
+		return r;
+	}
+	if (job->scope) {
+		r = sd_bus_message_append(m, "{sv}", "scope", "s", job->scope);
+		if (r < 0) {
+			return r;
+		}
+	}
+	if (job->paused || job->paused_usec) {
+		uint64_t now;
+
+		sd_event_now(context->event, CLOCK_MONOTONIC, &now);
+		r = sd_bus_message_append(m, "{sv}", "paused-usec", "t", job_get_paused_usec(job, now));
+		if (r < 0) {
+			return r;
+		}
+	}
+	if (job->pid) {
+		r = sd_bus_message_append(m, "{sv}", "output-signals", "t", job->output_signals);
+		if (r < 0) {
+			return r;
+		}
+	}
+	/* the last phase swupd reached tells how far a failed job got */
+	if (job->progress.phase != PROGRESS_NONE) {
+		r = sd_bus_message_append(m, "{sv}{sv}{sv}{sv}",
+					  "progress-phase", "s", progress_phase_name(job->progress.phase),
+					  "progress-percent", "u", job->progress.percent,
+					  "progress-done", "t", job->progress.done,
+					  "progress-total", "t", job->progress.total);
+		if (r < 0) {
+			return r;
+		}
+	}
+	if (job->exited) {
+		r = sd_bus_message_append(m, "{sv}{sv}{sv}",
+					  "user-usec", "t", timeval_to_usec(&job->rusage.ru_utime),
+					  "system-usec", "t", timeval_to_usec(&job->rusage.ru_stime),
+					  "max-rss", "t", (uint64_t) job->rusage.ru_maxrss * 1024);
+		if (r < 0) {
+			return r;
+		}
+	}
+	return sd_bus_message_close_container(m);
+}
+
+typedef struct _request_result {
+	daemon_state_t *context;
+	job_t *job;
+	int status;
+} request_result_t;
+
+static int append_request_completed(sd_bus_message *m, const void *data)
+{
+	const request_result_t *result = data;
+	int r;
+
+	r = sd_bus_message_append(m, "si", job_method_name(result->job->method), result->status);
+	if (r < 0) {
+		return r;
+	}
+
+	return append_job_details(m, result->context, result->job);
+}
+
+static void job_object_path(uint64_t id, char path[JOB_PATH_MAX])
+{
+	snprintf(path, JOB_PATH_MAX, JOB_OBJECT_PATH "/%" PRIu64, id);
+}
+
+static job_t *find_job_in(struct list *jobs, uint64_t id)
+{
+	struct list *item;
+
+	for (item = list_head(jobs); item; item = item->next) {
+		if (((job_t *)item->data)->id == id) {
+			return item->data;
+		}
+	}
+
+	return NULL;
+}
+
+/* Returns any job the daemon knows about, NULL if there is none with the
+ * id */
+static job_t *find_job(daemon_state_t *context, uint64_t id)
+{
+	job_t *job;
+
+	job = find_job_in(context->running, id);
+	if (!job) {
+		job = find_job_in(context->queue.jobs, id);
+	}
+	if (!job) {
+		job = find_job_in(context->finished, id);
+	}
+	if (!job && context->completing && context->completing->id == id) {
+		job = context->completing;
+	}
+
+	return job;
+}
+
+/* Emits PropertiesChanged on the bus and to every client connected
+ * directly, which has nobody else to get it from */
+static int emit_properties_changed(daemon_state_t *context, const char *path,
+				   const char *interface, char **names)
+{
+	struct list *item;
+	int r;
+
+	r = sd_bus_emit_properties_changed_strv(context->bus, path, interface, names);
+	for (item = list_head(context->peers); item; item = item->next) {
+		peer_t *peer = item->data;
+		int k;
+
+		k = sd_bus_emit_properties_changed_strv(peer->bus, path, interface, names);
+		if (k < 0 && r >= 0) {
+			r = k;
+		}
+	}
+
+	return r;
+}
+
+/* Emits PropertiesChanged for the properties of the job's object */
+static void emit_job_changed(daemon_state_t *context, job_t *job, char **names)
+{
+	char path[JOB_PATH_MAX];
+	int r;
+
+	job_object_path(job->id, path);
+	r = emit_properties_changed(context, path, JOB_INTERFACE, names);
+	if (r < 0) {
+		ERR("Can't emit properties of job %" PRIu64 ": %s", job->id, strerror(-r));
+	}
+}
+
+static int send_job_completed(daemon_state_t *context, sd_bus *bus, job_t *job, int status)
+{
+	sd_bus_message *m = NULL;
+	char path[JOB_PATH_MAX];
+	int r;
+
+	job_object_path(job->id, path);
+	r = sd_bus_message_new_signal(bus, &m, path, JOB_INTERFACE, "Completed");
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_message_append(m, "i", status);
+	if (r < 0) {
+		goto finish;
+	}
+	r = append_job_details(m, context, job);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_send(bus, m, NULL);
+
+finish:
+	sd_bus_message_unref(m);
+	return r;
+}
+
+/* Emits Completed on the job's object, for clients watching the job rather
+ * than the requests of their own, on the bus and to every client connected
+ * directly */
+static int emit_job_completed(daemon_state_t *context, job_t *job, int status)
+{
+	struct list *item;
+	int r;
+
+	r = send_job_completed(context, context->bus, job, status);
+	for (item = list_head(context->peers); item; item = item->next) {
+		peer_t *peer = item->data;
+		int k;
+
+		k = send_job_completed(context, peer->bus, job, status);
+		if (k < 0 && r >= 0) {
+			r = k;
+		}
+	}
+
+	return r;
+}
+
+/* Keeps the output of a job that ran for GetJobOutput, dropping the
+ * output of the least recently read jobs beyond the configured number */
+static void retire_job(daemon_state_t *context, job_t *job)
+{
+	struct list *last;
+
+	if (!job->pid || !context->config.output_history_jobs ||
+	    !context->config.output_history_size) {
+		job_free(job);
+		return;
+	}
+
+	free(job->output);
+	job->output = NULL;
+	job->output_len = job->output_size = 0;
+
+	context->finished = list_head(list_prepend_data(context->finished, job));
+	while (list_len(context->finished) > context->config.output_history_jobs) {
+		last = list_tail(context->finished);
+		job_free(last->data);
+		context->finished = list_head(list_free_item(last, NULL));
+	}
+}
+
+/* Replies to a request that waited for the job with its outcome, in place
+ * of RequestCompleted */
+static int reply_completed(daemon_state_t *context, sd_bus_message *request, job_t *job, int status)
+{
+	sd_bus_message *m = NULL;
+	char path[JOB_PATH_MAX];
+	int r;
+
+	job_object_path(job->id, path);
+	r = sd_bus_message_new_method_return(request, &m);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_message_append(m, "oi", path, status);
+	if (r < 0) {
+		goto finish;
+	}
+	r = append_job_details(m, context, job);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_send(sd_bus_message_get_bus(request), m, NULL);
+
+finish:
+	if (r < 0) {
+		ERR("Can't reply to %s request: %s", job_method_name(job->method), strerror(-r));
+	}
+	sd_bus_message_unref(m);
+	return r;
+}
+
+static void complete_job(daemon_state_t *context, job_t *job, int status)
+{
+	request_result_t result = { context, job, status };
+	struct list *item;
+	/* Merged bundle requests may have different outcomes for their
+	 * callers, so each of them gets its own answer */
+	bool merged = list_len(job->callers) > 1 &&
+		(job->method == METHOD_BUNDLE_ADD || job->method == METHOD_BUNDLE_REMOVE);
+	int r = 0;
+
+	/* the job is no longer in any list, but must still be found on the
+	 * bus while its final state is emitted */
+	job->completed = true;
+	job->status = status;
+	context->last_method = job->method;
+	context->last_status = status;
+	sd_event_now(context->event, CLOCK_REALTIME, &context->last_completed);
+	context->completing = job;
+	emit_job_changed(context, job, (char *[]) { "State", "ExitStatus", "UserUsec", "SystemUsec",
+						     "MaxRss", NULL });
+	r = emit_job_completed(context, job, status);
+	if (r < 0) {
+		ERR("Can't emit D-Bus signal: %s", strerror(-r));
+	}
+	context->completing = NULL;
+
+	for (item = list_head(job->callers); item; item = item->next) {
+		job_caller_t *caller = item->data;
+
+		result.status = merged ? job_caller_status(job, caller, status) : status;
+		if (caller->request) {
+			reply_completed(context, caller->request, job, result.status);
+			continue;
+		}
+		if (!is_signal_recipient(job, caller)) {
+			continue;
+		}
+		r = send_signal_to(context, caller->name, "RequestCompleted",
+				   append_request_completed, &result);
+		if (r < 0) {
+			ERR("Can't emit D-Bus signal: %s", strerror(-r));
+		}
+	}
+
+	result.status = status;
+	if (job->canceller_request) {
+		reply_completed(context, job->canceller_request, job, status);
+	} else if (job->canceller && !is_monitor(context, job->canceller)) {
+		r = send_signal_to(context, job->canceller, "RequestCompleted",
+				   append_request_completed, &result);
+		if (r < 0) {
+			ERR("Can't emit D-Bus signal: %s", strerror(-r));
+		}
+	}
+
+	/* monitors get the outcome of the job as a whole */
+	r = send_monitor_signal(context, job, JOB_STREAM_ALL, "RequestCompleted",
+				append_request_completed, &result);
+	if (r < 0) {
+		ERR("Can't emit D-Bus signal: %s", strerror(-r));
+	}
+
+	retire_job(context, job);
+}
+
+/* Writes the state to the status page, readers never wait for it */
+static void publish_status(daemon_state_t *context)
+{
+	struct list *item = list_head(context->running);
+	status_page_t state;
+
+	if (!context->status_page) {
+		return;
+	}
+
+	memset(&state, 0, sizeof(state));
+	sd_event_now(context->event, CLOCK_REALTIME, &state.updated);
+	if (item) {
+		job_t *job = item->data;
+
+		state.job_id = job->id;
+		snprintf(state.method, sizeof(state.method), "%s", job_method_name(job->method));
+		snprintf(state.phase, sizeof(state.phase), "%s",
+			 progress_phase_name(job->progress.phase));
+		state.percent = job->progress.percent;
+	}
+	state.running = list_len(context->running);
+	state.queued = context->queue.len;
+	if (context->last_method) {
+		state.last_status = context->last_status;
+		snprintf(state.last_method, sizeof(state.last_method), "%s",
+			 job_method_name(context->last_method));
+		state.last_completed = context->last_completed;
+	}
+	state.installed_version = context->os.installed_version;
+	state.available_version = context->os.available_version;
+	state.staged_version = context->staging.version;
+	state.check_status = context->os.check_status;
+	state.check_time = context->os.check_time;
+	state.update_time = context->os.update_time;
+
+	status_page_write(context->status_page, &state);
+}
+
+/* Keeps the status shown by systemctl in line with the properties */
+static void notify_status(daemon_state_t *context)
+{
+	char status[256];
+	size_t len;
+	job_t *job = list_head(context->running) ? list_head(context->running)->data : NULL;
+
+	if (job) {
+		len = snprintf(status, sizeof(status), "STATUS=Running %s",
+			       job_method_name(job->method));
+		if (list_len(context->running) > 1) {
+			len += snprintf(status + len, sizeof(status) - len, " and %u more",
+					list_len(context->running) - 1);
+		}
+	} else {
+		len = snprintf(status, sizeof(status), "STATUS=Idle");
+	}
+	if (context->queue.len) {
+		len += snprintf(status + len, sizeof(status) - len, ", %u queued", context->queue.len);
+	}
+	if (context->os.installed_version) {
+		len += snprintf(status + len, sizeof(status) - len, ". OS version %" PRIu32,
+				context->os.installed_version);
+	}
+	if (context->os.available_version) {
+		len += snprintf(status + len, sizeof(status) - len, ", %" PRIu32 " available",
+				context->os.available_version);
+	}
+	if (context->staging.version) {
+		snprintf(status + len, sizeof(status) - len, ", %" PRIu32 " staged",
+			 context->staging.version);
+	}
+
+	sd_notify(false, status);
+}
+
+static int on_changed(sd_event_source *s, void *userdata)
+{
+	daemon_state_t *context = userdata;
+	const char *names[16];
+	size_t n = 0;
+	int r;
+
+	if (context->changed & CHANGED_STAGING) {
+		names[n++] = "StagedVersion";
+		names[n++] = "StagedBytes";
+	}
+	if (context->changed & CHANGED_JOBS) {
+		names[n++] = "CurrentMethod";
+		names[n++] = "RunningJobs";
+		names[n++] = "QueueLength";
+	}
+	if (context->changed & CHANGED_OS) {
+		names[n++] = "InstalledVersion";
+		names[n++] = "AvailableVersion";
+		names[n++] = "LastCheckStatus";
+		names[n++] = "LastCheckTime";
+		names[n++] = "LastUpdateTime";
+	}
+	names[n] = NULL;
+	context->changed = 0;
+
+	r = emit_properties_changed(context, "/org/O1/swupdd/Client",
+				    "org.O1.swupdd.Client", (char **)names);
+	if (r < 0) {
+		ERR("Failed to emit signal: %s", strerror(-r));
+	}
+	notify_status(context);
+	publish_status(context);
+
+	return 0;
+}
+
+/* Properties often change together or several times while a request is
+ * handled, clients get a single PropertiesChanged for all of it */
+static void mark_changed(daemon_state_t *context, unsigned int changed)
+{
+	int r;
+
+	if (!context->changed_source) {
+		r = sd_event_add_defer(context->event, &context->changed_source, on_changed, context);
+		if (r < 0) {
+			ERR("Failed to add change handler: %s", strerror(-r));
+			return;
+		}
+		sd_event_source_set_priority(context->changed_source, SD_EVENT_PRIORITY_IDLE);
+	}
+	context->changed |= changed;
+	sd_event_source_set_enabled(context->changed_source, SD_EVENT_ONESHOT);
+}
+
+static void dispatch_jobs(daemon_state_t *context);
+static void update_pressure_timer(daemon_state_t *context);
+static job_priority_t admitted_priority(daemon_state_t *context);
+
+static int submit_job(daemon_state_t *context, job_t *job, sd_bus_message *m, uint64_t *ret_id,
+		      sd_bus_error *error);
+
+static void set_staging(daemon_state_t *context, uint32_t version, uint64_t bytes)
+{
+	if (context->staging.version == version && context->staging.bytes == bytes) {
+		return;
+	}
+
+	context->staging.version = version;
+	context->staging.bytes = bytes;
+	staging_save(&context->staging, STAGING_STATE_FILE);
+	mark_changed(context, CHANGED_STAGING);
+}
+
+static int on_staging_scan(sd_event_source *s, void *userdata)
+{
+	daemon_state_t *context = userdata;
+	int r;
+
+	r = staging_scan_step(&context->staging_scan, STAGING_SCAN_BATCH);
+	if (r > 0) {
+		return 0;
+	}
+	if (r < 0) {
+		ERR("Can't measure staged content: %s", strerror(-r));
+	}
+
+	sd_event_source_set_enabled(s, SD_EVENT_OFF);
+	staging_scan_stop(&context->staging_scan);
+	set_staging(context, context->staging_scan.version, context->staging_scan.bytes);
+
+	return 0;
+}
+
+/* Measures what the download staged, a walk over a large content store
+ * in one go would hold up the bus, Cancel included */
+static void measure_staging(daemon_state_t *context, job_t *job)
+{
+	int r;
+
+	r = staging_scan_start(&context->staging_scan, SWUPD_DEFAULT_STATEDIR, job->version,
+			       job->started_at);
+	if (r < 0) {
+		ERR("Can't measure staged content: %s", strerror(-r));
+		set_staging(context, job->version, 0);
+		return;
+	}
+
+	if (!context->staging_source) {
+		r = sd_event_add_defer(context->event, &context->staging_source, on_staging_scan, context);
+		if (r < 0) {
+			ERR("Failed to add staging scan: %s", strerror(-r));
+			staging_scan_stop(&context->staging_scan);
+			set_staging(context, job->version, 0);
+			return;
+		}
+		sd_event_source_set_priority(context->staging_source, SD_EVENT_PRIORITY_IDLE);
+	}
+	sd_event_source_set_enabled(context->staging_source, SD_EVENT_ON);
+}
+
+/* Chains a download of the version a check found, so that the update
+ * itself only has to apply staged content */
+static void predownload(daemon_state_t *context, uint32_t version)
+{
+	sd_bus_error error = SD_BUS_ERROR_NULL;
+	job_t *job;
+	int r;
+
+	if (context->staging.version == version ||
+	    (context->staging_scan.dir && context->staging_scan.version == version)) {
+		return;
+	}
+
+	job = job_new(METHOD_UPDATE);
+	if (!job) {
+		return;
+	}
+	job->args = list_append_data(job->args, strdup(SWUPD_CLIENT));
+	job->args = list_append_data(job->args, strdup(_method_opt_map[METHOD_UPDATE]));
+	job->args = list_append_data(job->args, strdup("--download"));
+	job->priority = JOB_PRIORITY_BACKGROUND;
+	job->budget = _predownload_budget;
+	job->version = version;
+	job->predownload = true;
+
+	DEBUG("Downloading version %" PRIu32 " ahead of the update", version);
+	r = submit_job(context, job, NULL, NULL, &error);
+	if (r < 0) {
+		ERR("Can't download version %" PRIu32 ": %s", version, error.message);
+		job_free(job);
+	}
+	sd_bus_error_free(&error);
+}
+
+/* Returns true if the job works on the system itself with the update
+ * server and format it's configured for */
+static bool uses_system_defaults(job_t *job)
+{
+	return !job_has_arg(job, "--statedir") && !job_has_arg(job, "--path") &&
+		!job_has_arg(job, "--url") && !job_has_arg(job, "--versionurl") &&
+		!job_has_arg(job, "--contenturl") && !job_has_arg(job, "--format");
+}
+
+/* Keeps track of the staged content as jobs affecting it finish */
+static void update_staging(daemon_state_t *context, job_t *job)
+{
+	if (job->status != 0) {
+		return;
+	}
+
+	if (job->predownload) {
+		measure_staging(context, job);
+	} else if (job->method == METHOD_UPDATE && !job_has_arg(job, "--download") &&
+		   !job_has_arg(job, "--statedir") && !job_has_arg(job, "--path")) {
+		/* staged content has been applied */
+		if (context->staging_source) {
+			sd_event_source_set_enabled(context->staging_source, SD_EVENT_OFF);
+		}
+		staging_scan_stop(&context->staging_scan);
+		set_staging(context, 0, 0);
+	} else if (job->method == METHOD_CHECK_UPDATE && job->version &&
+		   context->config.predownload && uses_system_defaults(job)) {
+		/* Only checks against the system's defaults are worth it,
+		 * the update is going to use those */
+		predownload(context, job->version);
+	}
+}
+
+/* Keeps track of the state of the OS as checks and updates against the
+ * system's defaults finish */
+static void update_osinfo(daemon_state_t *context, job_t *job)
+{
+	osinfo_t *os = &context->os;
+
+	if (job->predownload || !uses_system_defaults(job)) {
+		return;
+	}
+
+	if (job->method == METHOD_CHECK_UPDATE) {
+		os->check_status = job->status;
+		sd_event_now(context->event, CLOCK_REALTIME, &os->check_time);
+		/* a failed check doesn't tell whether the update is still
+		 * there, and one whose output went to the caller leaves
+		 * the daemon without the version */
+		if (job->status == 0 && !job->output_bypassed) {
+			os->available_version = job->version;
+		} else if (job->status == 1) {
+			os->available_version = 0;
+		}
+	} else if (job->method == METHOD_UPDATE && job->status == 0 &&
+		   !job_has_arg(job, "--download") && !job_has_arg(job, "--status")) {
+		os->installed_version = osinfo_read_version(OSINFO_OS_RELEASE_FILE);
+		sd_event_now(context->event, CLOCK_REALTIME, &os->update_time);
+		if (os->available_version <= os->installed_version) {
+			os->available_version = 0;
+		}
+	} else {
+		return;
+	}
+
+	osinfo_save(os, OSINFO_STATE_FILE);
+	mark_changed(context, CHANGED_OS);
+}
+
+/* Completes a job whose child is gone and whose output has been read up */
+static void finish_job(daemon_state_t *context, job_t *job)
+{
+	context->running = list_head(list_free_item(list_find_data(context->running, job), NULL));
+	update_staging(context, job);
+	update_osinfo(context, job);
+	complete_job(context, job, job->status);
+
+	dispatch_jobs(context);
+}
+
+static int on_child_exit(sd_event_source *s, const struct signalfd_siginfo *si, void *userdata)
+{
+	daemon_state_t *context = userdata;
+	int child_exit_status;
+	struct rusage rusage;
+	pid_t pid;
+
+	/* Several children may have exited by the time the signal gets
+	 * handled, so reap whatever is there instead of trusting si */
+	while ((pid = wait4(-1, &child_exit_status, WNOHANG, &rusage)) > 0) {
+		job_t *job = find_running_job(context, pid, -1);
+
+		if (!job) {
+			ERR("Reaped unknown child %i", pid);
+			continue;
+		}
+
+		job->rusage = rusage;
+
+		if (WIFEXITED(child_exit_status)) {
+			job->status = WEXITSTATUS(child_exit_status);
+		} else {
+			DEBUG("Child process was killed");
+			job->status = 128 + WTERMSIG(child_exit_status);
+		}
+		job->exited = true;
+
+		/* The result is reported once the rest of the output is
+		 * forwarded as well */
+		if (job->output_fd < 0 && job->error_fd < 0) {
+			finish_job(context, job);
+		}
+	}
+
+	return 0;
+}
+
+static void on_scope_ready(int r, void *userdata)
+{
+	job_t *job = userdata;
+
+	/* Without its scope swupd runs with the daemon's limits, which still
+	 * beats not running at all */
+	job->scope_request = NULL;
+	if (job->gate_fd >= 0) {
+		r = child_release(job->gate_fd, true);
+		if (r < 0) {
+			ERR("Can't release %s: %s", SWUPD_CLIENT, strerror(-r));
+		}
+		job->gate_fd = -1;
+	}
+}
+
+static int run_swupd(job_t *job, daemon_state_t *context)
+{
+	child_attr_t attr;
+	struct list *item;
+	char **argv;
+	pid_t pid;
+	int fds[2];
+	int errfds[2];
+	int r;
+
+	if (!context->swupd_path) {
+		ERR("No %s executable found", SWUPD_CLIENT);
+		return -ENOENT;
+	}
+
+	if (job->method == METHOD_BUNDLE_ADD || job->method == METHOD_BUNDLE_REMOVE) {
+		job_add_bundle_args(job);
+	}
+
+	/* Everything the child needs is prepared here, it only has to
+	 * redirect its output and exec */
+	argv = list_to_strv(list_head(job->args));
+	if (!argv) {
+		return -ENOMEM;
+	}
+
+	/* Output going to the caller's descriptor never passes through the
+	 * daemon, which then learns nothing from it */
+	if (job->output_sink >= 0) {
+		fds[0] = -1;
+		fds[1] = job->output_sink;
+		job->output_sink = -1;
+		job->output_bypassed = true;
+	} else if (pipe2(fds, O_CLOEXEC) < 0) {
+		ERR("Can't create pipe: %s", strerror(errno));
+		free(argv);
+		return -errno;
+	}
+	/* stderr gets a pipe of its own, so that clients can tell errors
+	 * from the rest and follow them alone */
+	if (pipe2(errfds, O_CLOEXEC) < 0) {
+		r = -errno;
+		ERR("Can't create pipe: %s", strerror(-r));
+		free(argv);
+		if (fds[0] >= 0) {
+			close(fds[0]);
+		}
+		close(fds[1]);
+		return r;
+	}
+
+	attr.exec_fd = context->swupd_fd;
+	attr.path = context->swupd_path;
+	attr.argv = argv;
+	attr.envp = environ;
+	attr.stdout_fd = fds[1];
+	attr.stderr_fd = errfds[1];
+	attr.nice = job->budget.nice == SCOPE_NICE_UNSET ? CHILD_NICE_INHERIT : job->budget.nice;
+	attr.ioprio = scope_budget_ioprio(&job->budget);
+	/* lets Pause stop swupd along with its helpers */
+	attr.new_group = true;
+
+	/* The scope keeps swupd from competing with services for CPU, I/O
+	 * and page cache. It only gets to exec once it is in there. */
+	if (context->config.resource_control &&
+	    asprintf(&job->scope, "swupdd-%i-%" PRIu64 ".scope", getpid(), job->id) < 0) {
+		job->scope = NULL;
+	}
+	attr.gated = job->scope != NULL;
+
+	pid = child_spawn(&attr, &job->pidfd, &job->gate_fd);
+	free(argv);
+	close(fds[1]);
+	close(errfds[1]);
+	if (pid < 0) {
+		ERR("Failed to spawn %s: %s", SWUPD_CLIENT, strerror(-pid));
+		if (fds[0] >= 0) {
+			close(fds[0]);
+		}
+		close(errfds[0]);
+		free(job->scope);
+		job->scope = NULL;
+		return pid;
+	}
+
+	job->pid = pid;
+	job->output_fd = fds[0];
+	job->error_fd = errfds[0];
+	if (fds[0] >= 0) {
+		r = sd_event_add_io(context->event, &job->output_source, fds[0], EPOLLIN,
+				    on_childs_output, context);
+		if (r < 0) {
+			goto fail;
+		}
+		sd_event_source_set_priority(job->output_source, OUTPUT_PRIORITY);
+		if (context->output_stalled) {
+			sd_event_source_set_enabled(job->output_source, SD_EVENT_OFF);
+		}
+	}
+	r = sd_event_add_io(context->event, &job->error_source, errfds[0], EPOLLIN,
+			    on_childs_errors, context);
+	if (r < 0) {
+		goto fail;
+	}
+	sd_event_source_set_priority(job->error_source, OUTPUT_PRIORITY);
+	if (context->output_stalled) {
+		sd_event_source_set_enabled(job->error_source, SD_EVENT_OFF);
+	}
+	item = list_append_data(context->running, job);
+	if (!item) {
+		r = -ENOMEM;
+		goto fail;
+	}
+	context->running = list_head(item);
+
+	/* Failing to get a scope is no reason to fail the job */
+	if (job->scope) {
+		r = scope_start(context->bus, job->scope, context->config.scope_slice, pid,
+				&job->budget, on_scope_ready, job, &job->scope_request);
+		if (r < 0) {
+			on_scope_ready(r, job);
+		}
+	}
+	ring_init(&job->history, context->config.output_history_size);
+
+	sd_event_now(context->event, CLOCK_REALTIME, &job->started_at);
+	emit_job_changed(context, job, (char *[]) { "State", "StartTime", "Args", NULL });
+
+	return 0;
+
+fail:
+	/* Output nobody reads would block swupd sooner or later, it doesn't
+	 * get to run at all */
+	ERR("Can't watch output of %s: %s", SWUPD_CLIENT, strerror(-r));
+	if (job->gate_fd >= 0) {
+		child_release(job->gate_fd, false);
+		job->gate_fd = -1;
+	}
+	child_kill(pid, job->pidfd, SIGKILL);
+	while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {}
+	job->output_source = sd_event_source_unref(job->output_source);
+	job->error_source = sd_event_source_unref(job->error_source);
+	if (fds[0] >= 0) {
+		close(fds[0]);
+	}
+	close(errfds[0]);
+	job->output_fd = -1;
+	job->error_fd = -1;
+	job->pid = 0;
+	if (job->pidfd >= 0) {
+		close(job->pidfd);
+		job->pidfd = -1;
+	}
+	free(job->scope);
+	job->scope = NULL;
+
+	return r;
+}
+
+/* Returns the lowest priority class allowed to start jobs */
+static job_priority_t admitted_priority(daemon_state_t *context)
+{
+	return context->pressure_busy ? JOB_PRIORITY_INTERACTIVE : JOB_PRIORITY_BACKGROUND;
+}
+
+static bool has_background_jobs(daemon_state_t *context)
+{
+	struct list *item;
+
+	for (item = list_head(context->running); item; item = item->next) {
+		if (((job_t *)item->data)->priority == JOB_PRIORITY_BACKGROUND) {
+			return true;
+		}
+	}
+	for (item = list_head(context->queue.jobs); item; item = item->next) {
+		if (((job_t *)item->data)->priority == JOB_PRIORITY_BACKGROUND) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static int pause_job(daemon_state_t *context, job_t *job, bool pause);
+
+/* Admits background jobs held for longer than configured in spite of the
+ * host's load, as the interactive jobs they now count as. Returns true if
+ * there were any. */
+static bool release_overdue_jobs(daemon_state_t *context, uint64_t now)
+{
+	uint64_t hold_max = (uint64_t) context->config.pressure_hold_max * 1000000;
+	struct list *item;
+	bool released = false;
+
+	if (!hold_max) {
+		return false;
+	}
+
+	for (item = list_head(context->queue.jobs); item; item = item->next) {
+		job_t *job = item->data;
+		uint64_t held_since = job->queued_at > context->pressure_busy_since ?
+			job->queued_at : context->pressure_busy_since;
+
+		if (job->priority == JOB_PRIORITY_BACKGROUND && now >= held_since + hold_max) {
+			DEBUG("Admitting %s request held for too long", job_method_name(job->method));
+			job->priority = JOB_PRIORITY_INTERACTIVE;
+			released = true;
+		}
+	}
+
+	return released;
+}
+
+/* Holds background jobs back while the host is busy, and pauses running
+ * ones if configured to. To avoid flapping the host is considered calm
+ * again only once the load drops to three quarters of the limits. */
+static void check_pressure(daemon_state_t *context)
+{
+	pressure_sample_t sample;
+	const char *exceeded;
+	struct list *item;
+	uint64_t now;
+	bool busy;
+
+	sd_event_now(context->event, CLOCK_MONOTONIC, &now);
+	pressure_read(context->config.pressure_path, context->config.loadavg_path,
+		      SWUPD_DEFAULT_STATEDIR, &sample);
+	exceeded = pressure_exceeded(&context->config.pressure_limits, &sample,
+				     context->pressure_busy ? 75 : 100);
+	busy = (exceeded != NULL);
+	if (busy == context->pressure_busy) {
+		if (busy && release_overdue_jobs(context, now)) {
+			dispatch_jobs(context);
+		}
+		return;
+	}
+
+	context->pressure_busy = busy;
+	if (busy) {
+		DEBUG("Holding background jobs, %s limit exceeded", exceeded);
+		context->pressure_busy_since = now;
+	} else {
+		DEBUG("Host load dropped, releasing background jobs");
+	}
+
+	for (item = list_head(context->running); item; item = item->next) {
+		job_t *job = item->data;
+
+		if (busy && context->config.pressure_pause &&
+		    job->priority == JOB_PRIORITY_BACKGROUND && !job->paused) {
+			if (pause_job(context, job, true) == 0) {
+				job->paused_by_pressure = true;
+			}
+		} else if (!busy && job->paused_by_pressure) {
+			pause_job(context, job, false);
+		}
+	}
+
+	if (!busy) {
+		dispatch_jobs(context);
+	}
+}
+
+static int on_pressure_timer(sd_event_source *s, uint64_t usec, void *userdata)
+{
+	daemon_state_t *context = userdata;
+
+	/* re-armed first, so that dispatching jobs finds it enabled */
+	sd_event_source_set_time(s, usec + (uint64_t) context->config.pressure_interval * 1000);
+	sd_event_source_set_enabled(s, SD_EVENT_ONESHOT);
+
+	check_pressure(context);
+	if (!has_background_jobs(context)) {
+		sd_event_source_set_enabled(s, SD_EVENT_OFF);
+	}
+
+	return 0;
+}
+
+/* Keeps the host's load sampled as long as there are background jobs */
+static void update_pressure_timer(daemon_state_t *context)
+{
+	int enabled = SD_EVENT_OFF;
+	uint64_t now;
+	int r;
+
+	if (!context->config.pressure_interval) {
+		return;
+	}
+
+	if (!has_background_jobs(context)) {
+		if (context->pressure_timer) {
+			sd_event_source_set_enabled(context->pressure_timer, SD_EVENT_OFF);
+		}
+		return;
+	}
+
+	if (context->pressure_timer) {
+		sd_event_source_get_enabled(context->pressure_timer, &enabled);
+	}
+	if (enabled != SD_EVENT_OFF) {
+		return;
+	}
+
+	sd_event_now(context->event, CLOCK_MONOTONIC, &now);
+	now += (uint64_t) context->config.pressure_interval * 1000;
+	if (!context->pressure_timer) {
+		r = sd_event_add_time(context->event, &context->pressure_timer, CLOCK_MONOTONIC,
+				      now, 0, on_pressure_timer, context);
+		if (r < 0) {
+			ERR("Failed to add pressure timer: %s", strerror(-r));
+			return;
+		}
+	} else {
+		sd_event_source_set_time(context->pressure_timer, now);
+		sd_event_source_set_enabled(context->pressure_timer, SD_EVENT_ONESHOT);
+	}
+}
+
+static int on_dispatch_timer(sd_event_source *s, uint64_t usec, void *userdata)
+{
+	dispatch_jobs(userdata);
+
+	return 0;
+}
+
+/* Starts queued jobs as long as there are free slots for them */
+static void dispatch_jobs(daemon_state_t *context)
+{
+	job_t *job;
+	uint64_t now;
+	uint64_t next;
+	int r;
+
+	sd_event_now(context->event, CLOCK_MONOTONIC, &now);
+	mark_changed(context, CHANGED_JOBS);
+
+	while (list_len(context->running) < context->config.max_running_jobs &&
+	       (job = job_queue_pop(&context->queue, context->running, now, admitted_priority(context)))) {
+		r = run_swupd(job, context);
+		if (r < 0) {
+			ERR("Failed to run queued %s request", job_method_name(job->method));
+			complete_job(context, job, r);
+		}
+	}
+
+	update_pressure_timer(context);
+
+	next = job_queue_next_ready(&context->queue, now);
+	if (!next) {
+		return;
+	}
+
+	if (!context->dispatch_timer) {
+		r = sd_event_add_time(context->event, &context->dispatch_timer, CLOCK_MONOTONIC,
+				      next, 0, on_dispatch_timer, context);
+		if (r < 0) {
+			ERR("Failed to add dispatch timer: %s", strerror(-r));
+		}
+		return;
+	}
+	sd_event_source_set_time(context->dispatch_timer, next);
+	sd_event_source_set_enabled(context->dispatch_timer, SD_EVENT_ONESHOT);
+}
+
+/* Returns a running or queued job with the same command the request can
+ * join. A running job qualifies while its history still holds all the
+ * output forwarded so far, which gets replayed to the late caller. */
+static job_t *find_same_job(daemon_state_t *context, job_t *job)
+{
+	struct list *item;
+
+	for (item = list_head(context->running); item; item = item->next) {
+		job_t *same = item->data;
+
+		if (!same->completed && !same->output_bypassed &&
+		    ring_start(&same->history) == 0 && job_same_command(job, same)) {
+			return same;
+		}
+	}
+	for (item = list_head(context->queue.jobs); item; item = item->next) {
+		if (job_same_command(job, item->data)) {
+			return item->data;
+		}
+	}
+
+	return NULL;
+}
+
+/* Returns a queued job the bundles of a new request can be added to */
+static job_t *find_batch_job(daemon_state_t *context, job_t *job)
+{
+	struct list *item;
+
+	for (item = list_head(context->queue.jobs); item; item = item->next) {
+		if (job_same_command(job, item->data)) {
+			return item->data;
+		}
+	}
+
+	return NULL;
+}
+
+/* Sends a caller joining a running job the stdout forwarded before it
+ * came, through its filter if it has one. What is still buffered reaches
+ * it along with everyone else. */
+static void replay_job_output(daemon_state_t *context, job_t *job, job_caller_t *caller)
+{
+	uint64_t offset = 0;
+	size_t len = job->history.end - job->output_len;
+	char *passed;
+	size_t passed_len;
+	char *text;
+	int r;
+
+	if (!len || !(caller->streams & JOB_STREAM_STDOUT) || !is_signal_recipient(job, caller)) {
+		return;
+	}
+
+	text = malloc(len + 1);
+	if (!text) {
+		ERR("Can't replay output of job %" PRIu64 ": %s", job->id, strerror(ENOMEM));
+		return;
+	}
+	len = ring_read(&job->history, &offset, text, len);
+	text[len] = '\0';
+
+	if (caller->filter) {
+		passed = filter_apply(caller->filter, text, len, false, false, &passed_len);
+		r = passed ? send_output(context, job, caller->name, JOB_STREAM_STDOUT,
+					 passed, passed_len) : 0;
+		free(passed);
+	} else {
+		r = send_output(context, job, caller->name, JOB_STREAM_STDOUT, text, len);
+	}
+	if (r < 0) {
+		ERR("Failed to emit signal: %s", strerror(-r));
+	}
+	free(text);
+}
+
+/* Takes over the job on success and returns the id of the job handling
+ * the request, which may be an identical one. Jobs the daemon starts on
+ * its own have no message and are run on behalf of root. Returns 1 if the
+ * request waits for the job, it's replied to once the job completes. */
+static int submit_job(daemon_state_t *context,
+		      job_t *job,
+		      sd_bus_message *m,
+		      uint64_t *ret_id,
+		      sd_bus_error *error)
+{
+	const char *sender = m ? request_sender(context, m) : NULL;
+	sd_bus_creds *creds = NULL;
+	uid_t uid = m ? (uid_t) -1 : 0;
+	scope_budget_t budget;
+	job_caller_t *caller;
+	job_t *same;
+	bool deferred = m && job->wait;
+	int r;
+
+	if (m && sd_bus_query_sender_creds(m, SD_BUS_CREDS_EUID, &creds) >= 0) {
+		sd_bus_creds_get_euid(creds, &uid);
+		sd_bus_creds_unref(creds);
+	}
+
+	/* Only root may grant swupd more than the configured budget */
+	config_get_budget(&context->config, job->method, &budget);
+	scope_budget_resolve(&job->budget, &budget, uid == 0);
+
+	/* Someone is waiting for whatever a client asks for, only the
+	 * daemon's own maintenance yields to the host's load */
+	if (job->priority == JOB_PRIORITY_MAX) {
+		job->priority = m ? JOB_PRIORITY_INTERACTIVE : JOB_PRIORITY_BACKGROUND;
+	}
+
+	/* Identical requests already running or queued are not worth another
+	 * swupd process, their results get shared instead. The same goes for
+	 * bundle requests with identical options, the union of their bundles
+	 * is handled in a single run. */
+	if (job_is_idempotent(job)) {
+		same = find_same_job(context, job);
+	} else if (job->method == METHOD_BUNDLE_ADD || job->method == METHOD_BUNDLE_REMOVE) {
+		same = find_batch_job(context, job);
+	} else {
+		same = NULL;
+	}
+	if (same) {
+		caller = job_add_caller(same, sender ? sender : "", uid, job->bundles);
+		if (!caller) {
+			sd_bus_error_set_errnof(error, ENOMEM, "Can't allocate memory for request");
+			return -ENOMEM;
+		}
+		caller->streams = job->streams;
+		caller->filter = job->filter;
+		if (deferred) {
+			caller->request = sd_bus_message_ref(m);
+		}
+		job->filter = NULL;
+		job->bundles = NULL;
+		if (job->priority < same->priority) {
+			same->priority = job->priority;
+		}
+		if (same->pid) {
+			replay_job_output(context, same, caller);
+		}
+		DEBUG("%s request joined identical job %" PRIu64, job_method_name(job->method), same->id);
+		if (ret_id) {
+			*ret_id = same->id;
+		}
+		job_free(job);
+		return deferred;
+	}
+
+	job->id = ++context->last_job_id;
+	job->uid = uid;
+	if (ret_id) {
+		*ret_id = job->id;
+	}
+	caller = job_add_caller(job, sender ? sender : "", uid, job->bundles);
+	if (!caller) {
+		sd_bus_error_set_errnof(error, ENOMEM, "Can't allocate memory for request");
+		return -ENOMEM;
+	}
+	caller->streams = job->streams;
+	caller->filter = job->filter;
+	if (deferred) {
+		caller->request = sd_bus_message_ref(m);
+	}
+	job->filter = NULL;
+	job->bundles = NULL;
+
+	/* Bundle requests wait a little for others to join them */
+	if ((job->method == METHOD_BUNDLE_ADD || job->method == METHOD_BUNDLE_REMOVE) &&
+	    context->config.bundle_batch_window) {
+		uint64_t now;
+
+		sd_event_now(context->event, CLOCK_MONOTONIC, &now);
+		job->not_before = now + (uint64_t) context->config.bundle_batch_window * 1000;
+	}
+
+	/* The timer may not be running yet, and a background job mustn't
+	 * start in the middle of a load spike */
+	if (job->priority == JOB_PRIORITY_BACKGROUND && context->config.pressure_interval) {
+		check_pressure(context);
+	}
+
+	/* Whatever is still queued at this point is either waiting for a
+	 * free slot or blocked by a conflict the new job must respect too */
+	if (!job->not_before && job->priority <= admitted_priority(context) &&
+	    list_len(context->running) < context->config.max_running_jobs &&
+	    !job_conflicts_with_any(job, context->running) &&
+	    !job_conflicts_with_any(job, context->queue.jobs)) {
+		r = run_swupd(job, context);
+		if (r < 0) {
+			sd_bus_error_set_errnof(error, -r, "Failed to run swupd command");
+			return r;
+		}
+		update_pressure_timer(context);
+		return deferred;
+	}
+
+	if (context->queue.len >= context->config.max_queue_depth) {
+		job_t *evicted = job_queue_evict(&context->queue, job->priority);
+
+		if (!evicted) {
+			sd_bus_error_set_errnof(error, EAGAIN, "Too many requests queued to swupd");
+			return -EAGAIN;
+		}
+		DEBUG("Queued %s request preempted by %s", job_method_name(evicted->method),
+		      job_method_name(job->method));
+		complete_job(context, evicted, -ECANCELED);
+	}
+
+	sd_event_now(context->event, CLOCK_MONOTONIC, &job->queued_at);
+	r = job_queue_push(&context->queue, job);
+	if (r < 0) {
+		sd_bus_error_set_errnof(error, -r, "Can't queue request");
+		return r;
+	}
+	dispatch_jobs(context);
+
+	return deferred;
+}
+
+static int on_schedule_timer(sd_event_source *s, uint64_t usec, void *userdata);
+
+/* Arms the timer for the next scheduled run, while the daemon is not
+ * running the timer is systemd's business */
+static void arm_schedule_timer(daemon_state_t *context)
+{
+	time_t next = schedule_next_any(&context->schedule, time(NULL));
+	int r;
+
+	if (!next) {
+		return;
+	}
+	if (next < context->schedule_retry) {
+		next = context->schedule_retry;
+	}
+
+	if (!context->schedule_timer) {
+		r = sd_event_add_time(context->event, &context->schedule_timer, CLOCK_REALTIME,
+				      (uint64_t) next * 1000000, 0, on_schedule_timer, context);
+		if (r < 0) {
+			ERR("Failed to add schedule timer: %s", strerror(-r));
+		}
+		return;
+	}
+	sd_event_source_set_time(context->schedule_timer, (uint64_t) next * 1000000);
+	sd_event_source_set_enabled(context->schedule_timer, SD_EVENT_ONESHOT);
+}
+
+static int run_scheduled_task(daemon_state_t *context, schedule_task_t task)
+{
+	sd_bus_error error = SD_BUS_ERROR_NULL;
+	method_t method = task == SCHEDULE_CHECK ? METHOD_CHECK_UPDATE : METHOD_UPDATE;
+	job_t *job;
+	int r;
+
+	job = job_new(method);
+	if (!job) {
+		return -ENOMEM;
+	}
+
+	job->args = list_append_data(job->args, strdup(SWUPD_CLIENT));
+	job->args = list_append_data(job->args, strdup(_method_opt_map[method]));
+	if (task == SCHEDULE_DOWNLOAD) {
+		job->args = list_append_data(job->args, strdup("--download"));
+	}
+	/* nobody is waiting for maintenance */
+	job->priority = JOB_PRIORITY_BACKGROUND;
+
+	r = submit_job(context, job, NULL, NULL, &error);
+	if (r < 0) {
+		ERR("Can't run scheduled %s: %s", schedule_task_name(task), error.message);
+		job_free(job);
+	}
+	sd_bus_error_free(&error);
+
+	return r;
+}
+
+static int on_schedule_timer(sd_event_source *s, uint64_t usec, void *userdata)
+{
+	daemon_state_t *context = userdata;
+	schedule_task_t task;
+	time_t now = time(NULL);
+
+	/* One task per expiry, the most comprehensive one first. The others
+	 * due find it queued or running and wait for it. Only a run that was
+	 * submitted counts as done, anything else is retried a little
+	 * later. */
+	for (task = SCHEDULE_MAX; task-- > 0;) {
+		time_t next = schedule_next_run(&context->schedule, task, now);
+
+		if (!next || next > now) {
+			continue;
+		}
+		if (run_scheduled_task(context, task) < 0) {
+			context->schedule_retry = now + SCHEDULE_RETRY_SEC;
+		} else {
+			context->schedule.last[task] = now;
+			schedule_save(&context->schedule, SCHEDULE_STATE_FILE);
+		}
+		break;
+	}
+
+	arm_schedule_timer(context);
+
+	return 0;
+}
+
+/* Replies to a request with the object path of the job handling it. The
+ * outcome is yet to come, unless the request waits for the job. */
+static int reply_with_job(sd_bus_message *m, uint64_t id)
+{
+	char path[JOB_PATH_MAX];
+
+	job_object_path(id, path);
+	return sd_bus_reply_method_return(m, "oia{sv}", path, -EINPROGRESS, 0);
+}
+
+static int method_update(sd_bus_message *m,
+	                 void *userdata,
+	                 sd_bus_error *ret_error)
+{
+	daemon_state_t *context = userdata;
+	int r = 0;
+	job_t *job;
+	uint64_t id;
+
+	job = job_new(METHOD_UPDATE);
+	if (!job) {
+		sd_bus_error_set_errnof(ret_error, ENOMEM, "Can't allocate memory for request");
+		return -ENOMEM;
+	}
+
+	job->args = list_append_data(job->args, strdup(SWUPD_CLIENT));
+	job->args = list_append_data(job->args, strdup(_method_opt_map[METHOD_UPDATE]));
+
+	char const * const str_opts[] = {"url", "contenturl", "versionurl",
+					 "format", "statedir", "path", NULL};
+	char const * const bool_opts[] = {"download", "status", "force", NULL};
+	char const * const int_opts[] = {"port", NULL};
+	r = bus_message_read_options(m, str_opts, bool_opts, int_opts, job, ret_error);
+	if (r < 0) {
+		goto finish;
+	}
+
+	r = submit_job(context, job, m, &id, ret_error);
+	if (r < 0) {
+		goto finish;
+	}
+	job = NULL;
+
+	if (r == 0) {
+		r = reply_with_job(m, id);
+	}
+
+finish:
+	job_free(job);
+	return r;
+}
+
+static int method_verify(sd_bus_message *m,
+	                 void *userdata,
+	                 sd_bus_error *ret_error)
+{
+	daemon_state_t *context = userdata;
+	int r = 0;
+	job_t *job;
+	uint64_t id;
+
+	job = job_new(METHOD_VERIFY);
+	if (!job) {
+		sd_bus_error_set_errnof(ret_error, ENOMEM, "Can't allocate memory for request");
+		return -ENOMEM;
+	}
+
+	job->args = list_append_data(job->args, strdup(SWUPD_CLIENT));
+	job->args = list_append_data(job->args, strdup(_method_opt_map[METHOD_VERIFY]));
+
+	char const * const str_opts[] = {"path", "url", "contenturl", "versionurl",
+					 "format", "statedir", NULL};
+	char const * const bool_opts[] = {"fix", "install", "quick", "force", NULL};
+	char const * const int_opts[] = {"manifest", "port", NULL};
+	r = bus_message_read_options(m, str_opts, bool_opts, int_opts, job, ret_error);
+	if (r < 0) {
+		goto finish;
+	}
+
+	r = submit_job(context, job, m, &id, ret_error);
+	if (r < 0) {
+		goto finish;
+	}
+	job = NULL;
+
+	if (r == 0) {
+		r = reply_with_job(m, id);
+	}
 
 finish:
-	list_free_list_and_data(args, free);
+	job_free(job);
 	return r;
 }
 
@@ -500,20 +2851,22 @@ static int method_check_update(sd_bus_message *m,
 {
 	daemon_state_t *context = userdata;
 	int r = 0;
-	struct list *args = NULL;
+	job_t *job;
+	uint64_t id;
 
-	r = check_prerequisites(context, ret_error);
-	if (r < 0) {
-		return r;
+	job = job_new(METHOD_CHECK_UPDATE);
+	if (!job) {
+		sd_bus_error_set_errnof(ret_error, ENOMEM, "Can't allocate memory for request");
+		return -ENOMEM;
 	}
 
-	args = list_append_data(args, strdup(SWUPD_CLIENT));
-	args = list_append_data(args, strdup(_method_opt_map[METHOD_CHECK_UPDATE]));
+	job->args = list_append_data(job->args, strdup(SWUPD_CLIENT));
+	job->args = list_append_data(job->args, strdup(_method_opt_map[METHOD_CHECK_UPDATE]));
 
 	char const * const str_opts[] = {"url", "versionurl", "format", "statedir", "path", NULL};
 	char const * const bool_opts[] = {"force", NULL};
 	char const * const int_opts[] = {"port", NULL};
-	r = bus_message_read_options(m, str_opts, bool_opts, int_opts, &args, ret_error);
+	r = bus_message_read_options(m, str_opts, bool_opts, int_opts, job, ret_error);
 	if (r < 0) {
 		goto finish;
 	}
@@ -524,18 +2877,20 @@ static int method_check_update(sd_bus_message *m,
 		sd_bus_error_set_errnof(ret_error, -r, "Can't read bundle");
 		goto finish;
 	}
-	args = list_append_data(args, strdup(bundle));
+	job->args = list_append_data(job->args, strdup(bundle));
 
-	r  = run_swupd(METHOD_CHECK_UPDATE, args, context);
+	r = submit_job(context, job, m, &id, ret_error);
 	if (r < 0) {
-		sd_bus_error_set_errnof(ret_error, -r, "Failed to run swupd command");
 		goto finish;
 	}
+	job = NULL;
 
-	r = sd_bus_reply_method_return(m, "b", (r >= 0));
+	if (r == 0) {
+		r = reply_with_job(m, id);
+	}
 
 finish:
-	list_free_list_and_data(args, free);
+	job_free(job);
 	return r;
 }
 
@@ -545,19 +2900,21 @@ static int method_hash_dump(sd_bus_message *m,
 {
 	daemon_state_t *context = userdata;
 	int r = 0;
-	struct list *args = NULL;
+	job_t *job;
+	uint64_t id;
 
-	r = check_prerequisites(context, ret_error);
-	if (r < 0) {
-		return r;
+	job = job_new(METHOD_HASH_DUMP);
+	if (!job) {
+		sd_bus_error_set_errnof(ret_error, ENOMEM, "Can't allocate memory for request");
+		return -ENOMEM;
 	}
 
-	args = list_append_data(args, strdup(SWUPD_CLIENT));
-	args = list_append_data(args, strdup(_method_opt_map[METHOD_HASH_DUMP]));
+	job->args = list_append_data(job->args, strdup(SWUPD_CLIENT));
+	job->args = list_append_data(job->args, strdup(_method_opt_map[METHOD_HASH_DUMP]));
 
 	char const * const str_opts[] = {"basepath", NULL};
 	char const * const bool_opts[] = {"no-xattrs", NULL};
-	r = bus_message_read_options(m, str_opts, bool_opts, NULL, &args, ret_error);
+	r = bus_message_read_options(m, str_opts, bool_opts, NULL, job, ret_error);
 	if (r < 0) {
 		goto finish;
 	}
@@ -568,18 +2925,20 @@ static int method_hash_dump(sd_bus_message *m,
 		sd_bus_error_set_errnof(ret_error, -r, "Can't read file name");
 		goto finish;
 	}
-	args = list_append_data(args, strdup(filename));
+	job->args = list_append_data(job->args, strdup(filename));
 
-	r  = run_swupd(METHOD_HASH_DUMP, args, context);
+	r = submit_job(context, job, m, &id, ret_error);
 	if (r < 0) {
-		sd_bus_error_set_errnof(ret_error, -r, "Failed to run swupd command");
 		goto finish;
 	}
+	job = NULL;
 
-	r = sd_bus_reply_method_return(m, "b", (r >= 0));
+	if (r == 0) {
+		r = reply_with_job(m, id);
+	}
 
 finish:
-	list_free_list_and_data(args, free);
+	job_free(job);
 	return r;
 }
 
@@ -589,22 +2948,24 @@ static int method_search(sd_bus_message *m,
 {
 	daemon_state_t *context = userdata;
 	int r = 0;
-	struct list *args = NULL;
+	job_t *job;
+	uint64_t id;
 
-	r = check_prerequisites(context, ret_error);
-	if (r < 0) {
-		return r;
+	job = job_new(METHOD_SEARCH);
+	if (!job) {
+		sd_bus_error_set_errnof(ret_error, ENOMEM, "Can't allocate memory for request");
+		return -ENOMEM;
 	}
 
-	args = list_append_data(args, strdup(SWUPD_CLIENT));
-	args = list_append_data(args, strdup(_method_opt_map[METHOD_SEARCH]));
+	job->args = list_append_data(job->args, strdup(SWUPD_CLIENT));
+	job->args = list_append_data(job->args, strdup(_method_opt_map[METHOD_SEARCH]));
 
 	char const * const str_opts[] = {"url", "contenturl", "versionurl",
 					 "path", "scope", "format", "statedir", NULL};
 	char const * const bool_opts[] = {"library", "binary", "init",
 					  "display-files", NULL};
 	char const * const int_opts[] = {"port", NULL};
-	r = bus_message_read_options(m, str_opts, bool_opts, int_opts, &args, ret_error);
+	r = bus_message_read_options(m, str_opts, bool_opts, int_opts, job, ret_error);
 	if (r < 0) {
 		goto finish;
 	}
@@ -615,18 +2976,20 @@ static int method_search(sd_bus_message *m,
 		sd_bus_error_set_errnof(ret_error, -r, "Can't read file name");
 		goto finish;
 	}
-	args = list_append_data(args, strdup(filename));
+	job->args = list_append_data(job->args, strdup(filename));
 
-	r  = run_swupd(METHOD_SEARCH, args, context);
+	r = submit_job(context, job, m, &id, ret_error);
 	if (r < 0) {
-		sd_bus_error_set_errnof(ret_error, -r, "Failed to run swupd command");
 		goto finish;
 	}
+	job = NULL;
 
-	r = sd_bus_reply_method_return(m, "b", (r >= 0));
+	if (r == 0) {
+		r = reply_with_job(m, id);
+	}
 
 finish:
-	list_free_list_and_data(args, free);
+	job_free(job);
 	return r;
 }
 
@@ -636,22 +2999,24 @@ static int method_bundle_add(sd_bus_message *m,
 {
 	daemon_state_t *context = userdata;
 	int r = 0;
-	struct list *args = NULL;
+	job_t *job;
+	uint64_t id;
 	const char* bundle = NULL;
 
-	r = check_prerequisites(context, ret_error);
-	if (r < 0) {
-		return r;
+	job = job_new(METHOD_BUNDLE_ADD);
+	if (!job) {
+		sd_bus_error_set_errnof(ret_error, ENOMEM, "Can't allocate memory for request");
+		return -ENOMEM;
 	}
 
-	args = list_append_data(args, strdup(SWUPD_CLIENT));
-	args = list_append_data(args, strdup(_method_opt_map[METHOD_BUNDLE_ADD]));
+	job->args = list_append_data(job->args, strdup(SWUPD_CLIENT));
+	job->args = list_append_data(job->args, strdup(_method_opt_map[METHOD_BUNDLE_ADD]));
 
 	char const * const str_opts[] = {"url", "contenturl", "versionurl",
 					 "path", "format", "statedir", NULL};
 	char const * const bool_opts[] = {"list", "force", NULL};
 	char const * const int_opts[] = {"port", NULL};
-	r = bus_message_read_options(m, str_opts, bool_opts, int_opts, &args, ret_error);
+	r = bus_message_read_options(m, str_opts, bool_opts, int_opts, job, ret_error);
 	if (r < 0) {
 		goto finish;
 	}
@@ -662,7 +3027,7 @@ static int method_bundle_add(sd_bus_message *m,
 		goto finish;
 	}
 	while ((r = sd_bus_message_read(m, "s", &bundle)) > 0) {
-		args = list_append_data(args, strdup(bundle));
+		job->bundles = list_append_data(job->bundles, strdup(bundle));
 	}
 	if (r < 0) {
 		sd_bus_error_set_errnof(ret_error, -r, "Can't read bundle name");
@@ -674,16 +3039,18 @@ static int method_bundle_add(sd_bus_message *m,
 		goto finish;
 	}
 
-	r  = run_swupd(METHOD_BUNDLE_ADD, args, context);
+	r = submit_job(context, job, m, &id, ret_error);
 	if (r < 0) {
-		sd_bus_error_set_errnof(ret_error, -r, "Failed to run swupd command");
 		goto finish;
 	}
+	job = NULL;
 
-	r = sd_bus_reply_method_return(m, "b", (r >= 0));
+	if (r == 0) {
+		r = reply_with_job(m, id);
+	}
 
 finish:
-	list_free_list_and_data(args, free);
+	job_free(job);
 	return r;
 }
 
@@ -693,44 +3060,421 @@ static int method_bundle_remove(sd_bus_message *m,
 {
 	daemon_state_t *context = userdata;
 	int r = 0;
-	struct list *args = NULL;
+	job_t *job;
+	uint64_t id;
+	const char* bundle = NULL;
 
-	r = check_prerequisites(context, ret_error);
-	if (r < 0) {
-		return r;
+	job = job_new(METHOD_BUNDLE_REMOVE);
+	if (!job) {
+		sd_bus_error_set_errnof(ret_error, ENOMEM, "Can't allocate memory for request");
+		return -ENOMEM;
 	}
 
-	args = list_append_data(args, strdup(SWUPD_CLIENT));
-	args = list_append_data(args, strdup(_method_opt_map[METHOD_BUNDLE_REMOVE]));
+	job->args = list_append_data(job->args, strdup(SWUPD_CLIENT));
+	job->args = list_append_data(job->args, strdup(_method_opt_map[METHOD_BUNDLE_REMOVE]));
 
 	char const * const str_opts[] = {"path", "url", "contenturl", "versionurl",
 					 "format", "statedir", NULL};
 	char const * const bool_opts[] = {"force", NULL};
 	char const * const int_opts[] = {"port", NULL};
-	r = bus_message_read_options(m, str_opts, bool_opts, int_opts, &args, ret_error);
+	r = bus_message_read_options(m, str_opts, bool_opts, int_opts, job, ret_error);
 	if (r < 0) {
 		goto finish;
 	}
 
-	const char *bundle;
-	r = sd_bus_message_read(m, "s", &bundle);
+	r = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "s");
+	if (r < 0) {
+		sd_bus_error_set_errnof(ret_error, -r, "Can't enter bundles container");
+		goto finish;
+	}
+	while ((r = sd_bus_message_read(m, "s", &bundle)) > 0) {
+		job->bundles = list_append_data(job->bundles, strdup(bundle));
+	}
 	if (r < 0) {
 		sd_bus_error_set_errnof(ret_error, -r, "Can't read bundle name");
 		goto finish;
 	}
-	args = list_append_data(args, strdup(bundle));
+	r = sd_bus_message_exit_container(m);
+	if (r < 0) {
+		sd_bus_error_set_errnof(ret_error, -r, "Can't exit bundles container");
+		goto finish;
+	}
+
+	r = submit_job(context, job, m, &id, ret_error);
+	if (r < 0) {
+		goto finish;
+	}
+	job = NULL;
+
+	if (r == 0) {
+		r = reply_with_job(m, id);
+	}
+
+finish:
+	job_free(job);
+	return r;
+}
+
+typedef struct _pause_change {
+	job_t *job;
+	uint64_t paused_usec;
+} pause_change_t;
+
+static int append_pause_changed(sd_bus_message *m, const void *data)
+{
+	const pause_change_t *change = data;
+
+	return sd_bus_message_append(m, "sbt", job_method_name(change->job->method),
+				     change->job->paused, change->paused_usec);
+}
+
+/* Freezes or thaws a running job. The cgroup freezer is preferred as the
+ * child can neither notice nor undo it, stopping the process group is
+ * the fallback for children outside of their scope. */
+static int pause_job(daemon_state_t *context, job_t *job, bool pause)
+{
+	pause_change_t change = { job, 0 };
+	uint64_t now;
+	int r;
+
+	if (job->exited || job->paused == pause) {
+		return 0;
+	}
+
+	if (pause) {
+		r = scope_freeze(job->pid, job->scope, true);
+		job->paused_by_signal = (r < 0);
+		if (r < 0) {
+			DEBUG("Can't freeze job %" PRIu64 ", stopping it instead: %s",
+			      job->id, strerror(-r));
+			r = kill(-job->pid, SIGSTOP) < 0 ? -errno : 0;
+		}
+	} else if (job->paused_by_signal) {
+		r = kill(-job->pid, SIGCONT) < 0 ? -errno : 0;
+	} else {
+		r = scope_freeze(job->pid, job->scope, false);
+	}
+	if (r < 0) {
+		ERR("Can't %s job %" PRIu64 ": %s", pause ? "pause" : "resume", job->id, strerror(-r));
+		return r;
+	}
+
+	sd_event_now(context->event, CLOCK_MONOTONIC, &now);
+	if (pause) {
+		job->paused_at = now;
+	} else {
+		job->paused_usec += now - job->paused_at;
+	}
+	job->paused = pause;
+	emit_job_changed(context, job, (char *[]) { "State", NULL });
+
+	change.paused_usec = job_get_paused_usec(job, now);
+	r = send_job_signal(context, job, JOB_STREAM_ALL, "PauseChanged", append_pause_changed, &change);
+	if (r < 0) {
+		ERR("Failed to emit signal: %s", strerror(-r));
+	}
+
+	return 0;
+}
+
+/* Pauses or resumes the running jobs of the caller, or all of them if the
+ * caller has none */
+static int set_jobs_paused(sd_bus_message *m,
+			   daemon_state_t *context,
+			   bool pause,
+			   sd_bus_error *ret_error)
+{
+	const char *sender = request_sender(context, m);
+	struct list *item;
+	bool owns_jobs = false;
+	int r = 0;
+
+	if (!context->running) {
+		sd_bus_error_set_errnof(ret_error, ECHILD, "No child process to %s", pause ? "pause" : "resume");
+		return -ECHILD;
+	}
+
+	for (item = list_head(context->running); item; item = item->next) {
+		if (job_find_caller(item->data, sender)) {
+			owns_jobs = true;
+			break;
+		}
+	}
+
+	for (item = list_head(context->running); item; item = item->next) {
+		job_t *job = item->data;
+
+		if (owns_jobs && !job_find_caller(job, sender)) {
+			continue;
+		}
+		if (pause_job(context, job, pause) < 0) {
+			r = -EIO;
+		}
+		/* explicit requests take precedence over admission control */
+		job->paused_by_pressure = false;
+	}
+	if (r < 0) {
+		sd_bus_error_set_errnof(ret_error, -r, "Can't %s all jobs", pause ? "pause" : "resume");
+		return r;
+	}
+
+	return sd_bus_reply_method_return(m, "b", true);
+}
+
+static int method_pause(sd_bus_message *m,
+			void *userdata,
+			sd_bus_error *ret_error)
+{
+	return set_jobs_paused(m, userdata, true, ret_error);
+}
+
+static int method_resume(sd_bus_message *m,
+			 void *userdata,
+			 sd_bus_error *ret_error)
+{
+	return set_jobs_paused(m, userdata, false, ret_error);
+}
+
+/* Makes the caller get the output, pause and completion signals of all
+ * jobs, not only of the ones it requested. Error monitors get stderr only
+ * of the output. The subscription ends when the caller leaves the bus. */
+static int subscribe(sd_bus_message *m,
+		     daemon_state_t *context,
+		     bool errors_only,
+		     sd_bus_error *ret_error)
+{
+	sd_bus_track *track = errors_only ? context->error_monitors : context->monitors;
+	sd_bus_track *other = errors_only ? context->monitors : context->error_monitors;
+	int r;
+
+	if (sd_bus_message_get_bus(m) != context->bus) {
+		sd_bus_error_set_errnof(ret_error, EOPNOTSUPP, "Monitoring requires the system bus");
+		return -EOPNOTSUPP;
+	}
+
+	r = sd_bus_track_add_sender(track, m);
+	if (r < 0) {
+		sd_bus_error_set_errnof(ret_error, -r, "Can't track the caller");
+		return r;
+	}
+	sd_bus_track_remove_sender(other, m);
+
+	return sd_bus_reply_method_return(m, "b", true);
+}
+
+static int method_subscribe(sd_bus_message *m,
+			    void *userdata,
+			    sd_bus_error *ret_error)
+{
+	return subscribe(m, userdata, false, ret_error);
+}
+
+static int method_subscribe_errors(sd_bus_message *m,
+				   void *userdata,
+				   sd_bus_error *ret_error)
+{
+	return subscribe(m, userdata, true, ret_error);
+}
+
+static int method_unsubscribe(sd_bus_message *m,
+			      void *userdata,
+			      sd_bus_error *ret_error)
+{
+	daemon_state_t *context = userdata;
+	int r;
+	int q;
+
+	if (sd_bus_message_get_bus(m) != context->bus) {
+		return sd_bus_reply_method_return(m, "b", false);
+	}
+
+	r = sd_bus_track_remove_sender(context->monitors, m);
+	q = sd_bus_track_remove_sender(context->error_monitors, m);
+	if (r < 0 || q < 0) {
+		sd_bus_error_set_errnof(ret_error, r < 0 ? -r : -q, "Can't stop tracking the caller");
+		return r < 0 ? r : q;
+	}
+
+	return sd_bus_reply_method_return(m, "b", r > 0 || q > 0);
+}
+
+/* Returns the output a job produced from offset on, as far as it is still
+ * kept. The reply carries the offset the data actually starts at, so that
+ * the client can tell what it missed, and whether more is to come. */
+static int method_get_job_output(sd_bus_message *m,
+				 void *userdata,
+				 sd_bus_error *ret_error)
+{
+	daemon_state_t *context = userdata;
+	sd_bus_message *reply = NULL;
+	struct list *item;
+	job_t *job;
+	uint64_t id;
+	uint64_t offset;
+	uint32_t maxlen;
+	char *buffer = NULL;
+	size_t len;
+	bool over = false;
+	int r;
+
+	r = sd_bus_message_read(m, "ttu", &id, &offset, &maxlen);
+	if (r < 0) {
+		sd_bus_error_set_errnof(ret_error, -r, "Can't read arguments");
+		return r;
+	}
+
+	job = find_job(context, id);
+	over = job && job->completed;
+	if (!job) {
+		sd_bus_error_set_errnof(ret_error, ENOENT, "No job %" PRIu64, id);
+		return -ENOENT;
+	}
+	/* the job read last is the last one to be dropped, without memory
+	 * for the new item it only keeps its place */
+	item = over ? list_find_data(context->finished, job) : NULL;
+	if (item) {
+		struct list *head = list_prepend_data(context->finished, job);
+
+		if (head) {
+			list_free_item(item, NULL);
+			context->finished = head;
+		}
+	}
+
+	if (maxlen > job->history.size) {
+		maxlen = job->history.size;
+	}
+	buffer = malloc(maxlen ? maxlen : 1);
+	if (!buffer) {
+		sd_bus_error_set_errnof(ret_error, ENOMEM, "Can't allocate memory for output");
+		return -ENOMEM;
+	}
+	len = ring_read(&job->history, &offset, buffer, maxlen);
+
+	r = sd_bus_message_new_method_return(m, &reply);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_message_append(reply, "t", offset);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_message_append_array(reply, SD_BUS_TYPE_BYTE, buffer, len);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_message_append(reply, "b", over);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_send(sd_bus_message_get_bus(m), reply, NULL);
+
+finish:
+	if (r < 0) {
+		sd_bus_error_set_errnof(ret_error, -r, "Can't reply with output");
+	}
+	sd_bus_message_unref(reply);
+	free(buffer);
+	return r;
+}
+
+static int append_job_entries(sd_bus_message *m, struct list *jobs, const char *state)
+{
+	struct list *item;
+	int r;
+
+	for (item = list_head(jobs); item; item = item->next) {
+		job_t *job = item->data;
+
+		r = sd_bus_message_append(m, "(tsst)", job->id, job_method_name(job->method),
+					  job->paused ? "paused" : state, job->history.end);
+		if (r < 0) {
+			return r;
+		}
+	}
+
+	return 0;
+}
+
+/* Lists the jobs GetJobOutput knows about with the offset their output
+ * ends at */
+static int method_list_jobs(sd_bus_message *m,
+			    void *userdata,
+			    sd_bus_error *ret_error)
+{
+	daemon_state_t *context = userdata;
+	sd_bus_message *reply = NULL;
+	int r;
 
-	r  = run_swupd(METHOD_BUNDLE_REMOVE, args, context);
+	r = sd_bus_message_new_method_return(m, &reply);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_message_open_container(reply, SD_BUS_TYPE_ARRAY, "(tsst)");
+	if (r < 0) {
+		goto finish;
+	}
+	r = append_job_entries(reply, context->running, "running");
+	if (r < 0) {
+		goto finish;
+	}
+	r = append_job_entries(reply, context->queue.jobs, "queued");
+	if (r < 0) {
+		goto finish;
+	}
+	r = append_job_entries(reply, context->finished, "finished");
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_message_close_container(reply);
 	if (r < 0) {
-		sd_bus_error_set_errnof(ret_error, -r, "Failed to run swupd command");
 		goto finish;
 	}
+	r = sd_bus_send(sd_bus_message_get_bus(m), reply, NULL);
+
+finish:
+	if (r < 0) {
+		sd_bus_error_set_errnof(ret_error, -r, "Can't reply with jobs");
+	}
+	sd_bus_message_unref(reply);
+	return r;
+}
+
+/* Detaches the caller from the job. The caller gets its RequestCompleted,
+ * or the reply to a request waiting for the job, right away if the job
+ * goes on for others, or once it is over otherwise. */
+static void cancel_caller(daemon_state_t *context, job_t *job, job_caller_t *caller)
+{
+	request_result_t result = { context, job, -ECANCELED };
+	sd_bus_message *request = caller->request;
+	char *name = caller->name;
+	int r;
+
+	caller->name = NULL;
+	caller->request = NULL;
+	job_remove_caller(job, caller);
+	if (!job->callers) {
+		if (job->canceller_request) {
+			reply_completed(context, job->canceller_request, job, -ECANCELED);
+			sd_bus_message_unref(job->canceller_request);
+		}
+		free(job->canceller);
+		job->canceller = name;
+		job->canceller_request = request;
+		return;
+	}
 
-	r = sd_bus_reply_method_return(m, "b", (r >= 0));
-
-finish:
-	list_free_list_and_data(args, free);
-	return r;
+	if (request) {
+		reply_completed(context, request, job, -ECANCELED);
+		sd_bus_message_unref(request);
+	} else if (!job_find_caller(job, name)) {
+		r = send_signal_to(context, name, "RequestCompleted",
+				   append_request_completed, &result);
+		if (r < 0) {
+			ERR("Can't emit D-Bus signal: %s", strerror(-r));
+		}
+	}
+	free(name);
 }
 
 static int method_cancel(sd_bus_message *m,
@@ -738,37 +3482,87 @@ static int method_cancel(sd_bus_message *m,
 			 sd_bus_error *ret_error)
 {
 	daemon_state_t *context = userdata;
+	const char *sender = request_sender(context, m);
+	struct list *item;
+	bool owns_jobs = false;
 	int r = 0;
-	pid_t child;
 	int force;
 
-	child = context->child;
-	if (!child) {
-		sd_bus_error_set_errnof(ret_error, ECHILD, "No child process to cancel");
-		return -ECHILD;
-	}
-
 	r = sd_bus_message_read(m, "b", &force);
 	if (r < 0) {
 		sd_bus_error_set_errnof(ret_error, -r, "Can't read 'force' option");
 		return r;
 	}
 
-	if (force) {
-		kill(child, SIGKILL);
-	} else {
-		kill(child, SIGTERM);
+	if (!context->running && !context->queue.len) {
+		sd_bus_error_set_errnof(ret_error, ECHILD, "No child process to cancel");
+		return -ECHILD;
+	}
+
+	/* Drop the caller's requests still waiting in the queue, unless
+	 * somebody else is waiting for the same results */
+	item = list_head(context->queue.jobs);
+	while (item) {
+		job_t *job = item->data;
+		job_caller_t *caller = job_find_caller(job, sender);
+
+		item = item->next;
+		if (caller) {
+			owns_jobs = true;
+			cancel_caller(context, job, caller);
+			if (!job->callers) {
+				job_queue_remove(&context->queue, job);
+				mark_changed(context, CHANGED_JOBS);
+				complete_job(context, job, -ECANCELED);
+			}
+		}
+	}
+
+	/* Running children are terminated if the caller is the only one
+	 * waiting for them, or all of them if the caller has nothing of its
+	 * own to cancel */
+	for (item = list_head(context->running); item; item = item->next) {
+		job_t *job = item->data;
+		job_caller_t *caller = job_find_caller(job, sender);
+
+		if (caller) {
+			owns_jobs = true;
+			cancel_caller(context, job, caller);
+			if (!job->callers && !job->exited) {
+				child_kill(job->pid, job->pidfd, force ? SIGKILL : SIGTERM);
+				/* a paused child would never get to handle it */
+				pause_job(context, job, false);
+			}
+		}
+	}
+	if (!owns_jobs) {
+		for (item = list_head(context->running); item; item = item->next) {
+			job_t *job = item->data;
+
+			if (job->exited) {
+				continue;
+			}
+			if (force) {
+				child_kill(job->pid, job->pidfd, SIGKILL);
+			} else {
+				child_kill(job->pid, job->pidfd, SIGTERM);
+			}
+			pause_job(context, job, false);
+		}
 	}
 
 	return sd_bus_reply_method_return(m, "b", (r >= 0));
 }
 
+static void free_peer(void *data);
+
 /* Basically this is a copypasta from systemd's internal function bus_event_loop_with_idle() */
 static int run_bus_event_loop(sd_event *event,
 			      daemon_state_t *context)
 {
 	sd_bus *bus = context->bus;
 	bool exiting = false;
+	bool handed_off = false;
 	int r, code;
 
 	for (;;) {
@@ -781,13 +3575,31 @@ static int run_bus_event_loop(sd_event *event,
 			break;
 		}
 
-		r = sd_event_run(event, exiting ? (uint64_t) -1 : (uint64_t) TIMEOUT_EXIT_SEC * 1000000);
+		r = sd_event_run(event, exiting ? (uint64_t) -1 : idle_timeout(&context->idle));
 		if (r < 0) {
 			ERR("Failed to run event loop: %s", strerror(-r));
 			return r;
 		}
 
-		if (!context->method && r == 0 && !exiting) {
+		if (!context->running && !context->queue.len && r == 0 && !exiting) {
+			time_t next = schedule_next_any(&context->schedule, time(NULL));
+
+			/* An open connection is no reason to stay, clients
+			 * connecting directly have nothing left to wait for and
+			 * get the daemon started again on their next request */
+			if (context->peers) {
+				DEBUG("Disconnecting %u idle peers", list_len(context->peers));
+				list_free_list_and_data(context->peers, free_peer);
+				context->peers = NULL;
+			}
+
+			/* Let systemd start the daemon again in time for the
+			 * next scheduled run */
+			if (next && !handed_off) {
+				schedule_handoff(bus, next);
+				handed_off = true;
+			}
+
 			r = sd_bus_try_close(bus);
 			if (r == -EBUSY) {
 				continue;
@@ -860,35 +3672,600 @@ static int run_bus_event_loop(sd_event *event,
         return code;
 }
 
+static int property_get_queue_depth(sd_bus *bus,
+				    const char *path,
+				    const char *interface,
+				    const char *property,
+				    sd_bus_message *reply,
+				    void *userdata,
+				    sd_bus_error *ret_error)
+{
+	uint64_t queued = 0;
+
+	get_queued_writes(userdata, &queued);
+
+	return sd_bus_message_append(reply, "t", queued);
+}
+
+/* Method of the job started first among the running ones, empty if
+ * there are none */
+static int property_get_current_method(sd_bus *bus,
+				       const char *path,
+				       const char *interface,
+				       const char *property,
+				       sd_bus_message *reply,
+				       void *userdata,
+				       sd_bus_error *ret_error)
+{
+	daemon_state_t *context = userdata;
+	struct list *item = list_head(context->running);
+
+	return sd_bus_message_append(reply, "s",
+				     item ? job_method_name(((job_t *)item->data)->method) : "");
+}
+
+static int property_get_running_jobs(sd_bus *bus,
+				     const char *path,
+				     const char *interface,
+				     const char *property,
+				     sd_bus_message *reply,
+				     void *userdata,
+				     sd_bus_error *ret_error)
+{
+	daemon_state_t *context = userdata;
+
+	return sd_bus_message_append(reply, "u", list_len(context->running));
+}
+
+static int property_get_idle_mode(sd_bus *bus,
+				  const char *path,
+				  const char *interface,
+				  const char *property,
+				  sd_bus_message *reply,
+				  void *userdata,
+				  sd_bus_error *ret_error)
+{
+	daemon_state_t *context = userdata;
+
+	return sd_bus_message_append(reply, "s", idle_mode_name(context->idle.mode));
+}
+
+/* UINT64_MAX if the daemon doesn't exit */
+static int property_get_idle_timeout(sd_bus *bus,
+				     const char *path,
+				     const char *interface,
+				     const char *property,
+				     sd_bus_message *reply,
+				     void *userdata,
+				     sd_bus_error *ret_error)
+{
+	daemon_state_t *context = userdata;
+
+	return sd_bus_message_append(reply, "t", idle_timeout(&context->idle));
+}
+
+/* Time output was held back for, including a stall still going on */
+static int property_get_stall_usec(sd_bus *bus,
+				   const char *path,
+				   const char *interface,
+				   const char *property,
+				   sd_bus_message *reply,
+				   void *userdata,
+				   sd_bus_error *ret_error)
+{
+	daemon_state_t *context = userdata;
+	uint64_t usec = context->stall_usec;
+	uint64_t now;
+
+	if (context->output_stalled) {
+		sd_event_now(context->event, CLOCK_MONOTONIC, &now);
+		usec += now - context->stalled_at;
+	}
+
+	return sd_bus_message_append(reply, "t", usec);
+}
+
 static const sd_bus_vtable swupdd_vtable[] = {
 	SD_BUS_VTABLE_START(0),
-	SD_BUS_METHOD("CheckUpdate", "a{sv}s", "b", method_check_update, 0),
-	SD_BUS_METHOD("HashDump", "a{sv}s", "b", method_hash_dump, 0),
-	SD_BUS_METHOD("Search", "a{sv}s", "b", method_search, 0),
-	SD_BUS_METHOD("Update", "a{sv}", "b", method_update, 0),
-	SD_BUS_METHOD("Verify", "a{sv}", "b", method_verify, 0),
-	SD_BUS_METHOD("BundleAdd", "a{sv}as", "b", method_bundle_add, 0),
-	SD_BUS_METHOD("BundleRemove", "a{sv}s", "b", method_bundle_remove, 0),
+	SD_BUS_METHOD("CheckUpdate", "a{sv}s", "oia{sv}", method_check_update, 0),
+	SD_BUS_METHOD("HashDump", "a{sv}s", "oia{sv}", method_hash_dump, 0),
+	SD_BUS_METHOD("Search", "a{sv}s", "oia{sv}", method_search, 0),
+	SD_BUS_METHOD("Update", "a{sv}", "oia{sv}", method_update, 0),
+	SD_BUS_METHOD("Verify", "a{sv}", "oia{sv}", method_verify, 0),
+	SD_BUS_METHOD("BundleAdd", "a{sv}as", "oia{sv}", method_bundle_add, 0),
+	SD_BUS_METHOD("BundleRemove", "a{sv}as", "oia{sv}", method_bundle_remove, 0),
 	SD_BUS_METHOD("Cancel", "b", "b", method_cancel, 0),
-	SD_BUS_SIGNAL("RequestCompleted", "si", 0),
+	SD_BUS_METHOD("Pause", "", "b", method_pause, 0),
+	SD_BUS_METHOD("Resume", "", "b", method_resume, 0),
+	SD_BUS_METHOD("Subscribe", "", "b", method_subscribe, 0),
+	SD_BUS_METHOD("SubscribeErrors", "", "b", method_subscribe_errors, 0),
+	SD_BUS_METHOD("Unsubscribe", "", "b", method_unsubscribe, 0),
+	SD_BUS_METHOD("GetJobOutput", "ttu", "tayb", method_get_job_output, 0),
+	SD_BUS_METHOD("ListJobs", "", "a(tsst)", method_list_jobs, 0),
+	SD_BUS_PROPERTY("StagedVersion", "u", NULL, offsetof(daemon_state_t, staging.version),
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("StagedBytes", "t", NULL, offsetof(daemon_state_t, staging.bytes),
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("CurrentMethod", "s", property_get_current_method, 0,
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("RunningJobs", "u", property_get_running_jobs, 0,
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("QueueLength", "u", NULL, offsetof(daemon_state_t, queue.len),
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("InstalledVersion", "u", NULL, offsetof(daemon_state_t, os.installed_version),
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("AvailableVersion", "u", NULL, offsetof(daemon_state_t, os.available_version),
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("LastCheckStatus", "i", NULL, offsetof(daemon_state_t, os.check_status),
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("LastCheckTime", "t", NULL, offsetof(daemon_state_t, os.check_time),
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("LastUpdateTime", "t", NULL, offsetof(daemon_state_t, os.update_time),
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("IdleMode", "s", property_get_idle_mode, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+	SD_BUS_PROPERTY("IdleTimeoutUsec", "t", property_get_idle_timeout, 0, 0),
+	SD_BUS_PROPERTY("Activations", "t", NULL, offsetof(daemon_state_t, idle.activations),
+			SD_BUS_VTABLE_PROPERTY_CONST),
+	SD_BUS_PROPERTY("StartupUsec", "t", NULL, offsetof(daemon_state_t, startup_usec),
+			SD_BUS_VTABLE_PROPERTY_CONST),
+	SD_BUS_PROPERTY("TotalStartupUsec", "t", NULL, offsetof(daemon_state_t, idle.startup_usec),
+			SD_BUS_VTABLE_PROPERTY_CONST),
+	SD_BUS_PROPERTY("OutputQueueDepth", "t", property_get_queue_depth, 0, 0),
+	SD_BUS_PROPERTY("OutputQueuePeak", "t", NULL, offsetof(daemon_state_t, queue_peak), 0),
+	SD_BUS_PROPERTY("OutputStalls", "t", NULL, offsetof(daemon_state_t, stalls), 0),
+	SD_BUS_PROPERTY("OutputStallUsec", "t", property_get_stall_usec, 0, 0),
+	SD_BUS_SIGNAL("RequestCompleted", "sia{sv}", 0),
 	SD_BUS_SIGNAL("ChildOutputReceived", "s", 0),
+	SD_BUS_SIGNAL("ChildErrorReceived", "s", 0),
+	SD_BUS_SIGNAL("ChildOutputLines", "as", 0),
+	SD_BUS_SIGNAL("PauseChanged", "sbt", 0),
+	SD_BUS_SIGNAL("Progress", "tssuttt", 0),
+	SD_BUS_VTABLE_END
+};
+
+/* Resolves the path of a job's object to the job */
+static int find_job_object(sd_bus *bus,
+			   const char *path,
+			   const char *interface,
+			   void *userdata,
+			   void **found,
+			   sd_bus_error *ret_error)
+{
+	daemon_state_t *context = userdata;
+	const char *id = path + strlen(JOB_OBJECT_PATH "/");
+	char *end;
+	job_t *job;
+
+	if (strncmp(path, JOB_OBJECT_PATH "/", strlen(JOB_OBJECT_PATH "/")) != 0 ||
+	    !isdigit(*id)) {
+		return 0;
+	}
+	errno = 0;
+	job = find_job(context, strtoull(id, &end, 10));
+	if (errno || *end || !job) {
+		return 0;
+	}
+
+	*found = job;
+	return 1;
+}
+
+static int enumerate_jobs(sd_bus *bus,
+			  const char *path,
+			  void *userdata,
+			  char ***nodes,
+			  sd_bus_error *ret_error)
+{
+	daemon_state_t *context = userdata;
+	struct list *lists[] = { context->running, context->queue.jobs, context->finished };
+	struct list *item;
+	char **paths;
+	size_t n = 0;
+	size_t i;
+
+	for (i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+		n += list_len(lists[i]);
+	}
+	paths = calloc(n + 1, sizeof(char *));
+	if (!paths) {
+		return -ENOMEM;
+	}
+
+	n = 0;
+	for (i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+		for (item = list_head(lists[i]); item; item = item->next) {
+			char buffer[JOB_PATH_MAX];
+
+			job_object_path(((job_t *)item->data)->id, buffer);
+			paths[n] = strdup(buffer);
+			if (!paths[n]) {
+				while (n > 0) {
+					free(paths[--n]);
+				}
+				free(paths);
+				return -ENOMEM;
+			}
+			n++;
+		}
+	}
+
+	*nodes = paths;
+	return 0;
+}
+
+static int property_get_job_method(sd_bus *bus,
+				   const char *path,
+				   const char *interface,
+				   const char *property,
+				   sd_bus_message *reply,
+				   void *userdata,
+				   sd_bus_error *ret_error)
+{
+	job_t *job = userdata;
+
+	return sd_bus_message_append(reply, "s", job_method_name(job->method));
+}
+
+static int property_get_job_args(sd_bus *bus,
+				 const char *path,
+				 const char *interface,
+				 const char *property,
+				 sd_bus_message *reply,
+				 void *userdata,
+				 sd_bus_error *ret_error)
+{
+	job_t *job = userdata;
+	struct list *item;
+	int r;
+
+	r = sd_bus_message_open_container(reply, SD_BUS_TYPE_ARRAY, "s");
+	if (r < 0) {
+		return r;
+	}
+	for (item = list_head(job->args); item; item = item->next) {
+		r = sd_bus_message_append(reply, "s", item->data);
+		if (r < 0) {
+			return r;
+		}
+	}
+
+	return sd_bus_message_close_container(reply);
+}
+
+static int property_get_job_state(sd_bus *bus,
+				  const char *path,
+				  const char *interface,
+				  const char *property,
+				  sd_bus_message *reply,
+				  void *userdata,
+				  sd_bus_error *ret_error)
+{
+	job_t *job = userdata;
+	const char *state = "queued";
+
+	if (job->completed) {
+		state = "finished";
+	} else if (job->paused) {
+		state = "paused";
+	} else if (job->pid) {
+		state = "running";
+	}
+
+	return sd_bus_message_append(reply, "s", state);
+}
+
+/* Resources used by the child, known once it has been reaped */
+static int property_get_job_rusage(sd_bus *bus,
+				   const char *path,
+				   const char *interface,
+				   const char *property,
+				   sd_bus_message *reply,
+				   void *userdata,
+				   sd_bus_error *ret_error)
+{
+	job_t *job = userdata;
+	uint64_t value;
+
+	if (strcmp(property, "UserUsec") == 0) {
+		value = timeval_to_usec(&job->rusage.ru_utime);
+	} else if (strcmp(property, "SystemUsec") == 0) {
+		value = timeval_to_usec(&job->rusage.ru_stime);
+	} else {
+		value = (uint64_t) job->rusage.ru_maxrss * 1024;
+	}
+
+	return sd_bus_message_append(reply, "t", value);
+}
+
+/* Jobs the daemon knows about, from submission until their output is
+ * dropped from the history, at JOB_OBJECT_PATH/<id> */
+static const sd_bus_vtable job_vtable[] = {
+	SD_BUS_VTABLE_START(0),
+	SD_BUS_PROPERTY("Id", "t", NULL, offsetof(job_t, id), SD_BUS_VTABLE_PROPERTY_CONST),
+	SD_BUS_PROPERTY("Method", "s", property_get_job_method, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+	SD_BUS_PROPERTY("Args", "as", property_get_job_args, 0,
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("State", "s", property_get_job_state, 0,
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("StartTime", "t", NULL, offsetof(job_t, started_at),
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("ExitStatus", "i", NULL, offsetof(job_t, status),
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("OutputBytes", "t", NULL, offsetof(job_t, history.end), 0),
+	SD_BUS_PROPERTY("UserUsec", "t", property_get_job_rusage, 0,
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("SystemUsec", "t", property_get_job_rusage, 0,
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("MaxRss", "t", property_get_job_rusage, 0,
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_SIGNAL("Completed", "ia{sv}", 0),
 	SD_BUS_VTABLE_END
 };
 
+static void free_peer(void *data)
+{
+	peer_t *peer = data;
+
+	sd_bus_detach_event(peer->bus);
+	sd_bus_flush_close_unref(peer->bus);
+	free(peer->name);
+	free(peer);
+}
+
+static int on_peer_disconnected(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+{
+	daemon_state_t *context = userdata;
+	peer_t *peer = find_peer(context, sd_bus_message_get_bus(m), NULL);
+
+	if (!peer) {
+		return 0;
+	}
+	DEBUG("%s disconnected", peer->name);
+	/* requests of the peer still running hold on to the connection
+	 * until their jobs complete */
+	context->peers = list_head(list_free_item(list_find_data(context->peers, peer), free_peer));
+
+	return 0;
+}
+
+/* Serves the Client and Job objects on a direct connection, as if the
+ * peer called over the bus */
+static int add_peer(daemon_state_t *context, int fd)
+{
+	peer_t *peer;
+	int r;
+
+	peer = calloc(1, sizeof(peer_t));
+	if (!peer) {
+		close(fd);
+		return -ENOMEM;
+	}
+	if (asprintf(&peer->name, "peer-%" PRIu64, ++context->last_peer_id) < 0) {
+		peer->name = NULL;
+		close(fd);
+		r = -ENOMEM;
+		goto finish;
+	}
+
+	r = sd_bus_new(&peer->bus);
+	if (r < 0) {
+		close(fd);
+		goto finish;
+	}
+	r = sd_bus_set_fd(peer->bus, fd, fd);
+	if (r < 0) {
+		close(fd);
+		goto finish;
+	}
+	r = sd_bus_set_server(peer->bus, true, context->peer_server_id);
+	if (r < 0) {
+		goto finish;
+	}
+	/* for "output-fd" */
+	r = sd_bus_negotiate_fds(peer->bus, true);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_add_object_vtable(peer->bus, NULL, "/org/O1/swupdd/Client", "org.O1.swupdd.Client",
+				     swupdd_vtable, context);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_add_fallback_vtable(peer->bus, NULL, JOB_OBJECT_PATH, JOB_INTERFACE, job_vtable,
+				       find_job_object, context);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_add_node_enumerator(peer->bus, NULL, JOB_OBJECT_PATH, enumerate_jobs, context);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_add_filter(peer->bus, NULL, on_incoming_message, context);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_add_match(peer->bus, NULL,
+			     "type='signal',"
+			     "path='/org/freedesktop/DBus/Local',"
+			     "interface='org.freedesktop.DBus.Local',"
+			     "member='Disconnected'",
+			     on_peer_disconnected, context);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_start(peer->bus);
+	if (r < 0) {
+		goto finish;
+	}
+	r = sd_bus_attach_event(peer->bus, context->event, SD_EVENT_PRIORITY_NORMAL);
+	if (r < 0) {
+		goto finish;
+	}
+
+	context->peers = list_head(list_append_data(context->peers, peer));
+	peer = NULL;
+
+finish:
+	if (peer) {
+		sd_bus_unref(peer->bus);
+		free(peer->name);
+		free(peer);
+	}
+	return r;
+}
+
+static int on_peer_connect(sd_event_source *s, int fd, uint32_t revents, void *userdata)
+{
+	daemon_state_t *context = userdata;
+	struct ucred cred;
+	int peer_fd;
+	int r;
+
+	peer_fd = peer_accept(fd, &cred);
+	if (peer_fd < 0) {
+		if (peer_fd != -EAGAIN && peer_fd != -EINTR) {
+			ERR("Can't accept direct connection: %s", strerror(-peer_fd));
+		}
+		return 0;
+	}
+	if (!peer_authorized(&cred, context->peer_group)) {
+		DEBUG("Refusing direct connection of uid %u", (unsigned int) cred.uid);
+		close(peer_fd);
+		return 0;
+	}
+
+	r = add_peer(context, peer_fd);
+	if (r < 0) {
+		ERR("Can't set up direct connection: %s", strerror(-r));
+	}
+
+	return 0;
+}
+
+/* Local clients may skip the broker, which relays every request and
+ * every chunk of output otherwise */
+static int listen_for_peers(daemon_state_t *context)
+{
+	struct group *group;
+	int r;
+
+	context->peer_group = (gid_t) -1;
+	if (context->config.peer_group) {
+		group = getgrnam(context->config.peer_group);
+		if (!group) {
+			ERR("Unknown group '%s', falling back to root's group",
+			    context->config.peer_group);
+			context->peer_group = 0;
+		} else {
+			context->peer_group = group->gr_gid;
+		}
+	}
+
+	r = sd_id128_randomize(&context->peer_server_id);
+	if (r < 0) {
+		return r;
+	}
+	context->peer_fd = peer_listen(PEER_SOCKET_PATH);
+	if (context->peer_fd < 0) {
+		return context->peer_fd;
+	}
+
+	return sd_event_add_io(context->event, &context->peer_source, context->peer_fd, EPOLLIN,
+			       on_peer_connect, context);
+}
+
+static const struct option prog_opts[] = {
+	{ "help", no_argument, 0, 'h' },
+	{ "config", required_argument, 0, 'c' },
+	{ 0, 0, 0, 0 }
+};
+
+static void print_help(const char *name)
+{
+	printf("Usage:\n");
+	printf("   %s [OPTION...]\n\n", basename((char *)name));
+	printf("Help Options:\n");
+	printf("   -h, --help              Show help options\n\n");
+	printf("Application Options:\n");
+	printf("   -c, --config=[FILE]     Read configuration from FILE instead of %s\n", SWUPDD_CONFIG_FILE);
+	printf("\n");
+}
+
 int main(int argc, char *argv[]) {
 	daemon_state_t context;
 	sd_bus_slot *slot = NULL;
+	sd_bus_slot *job_slot = NULL;
+	sd_bus_slot *enumerator_slot = NULL;
 	sd_event *event = NULL;
+	const char *config_file = SWUPDD_CONFIG_FILE;
+	struct timespec started;
+	struct timespec ready;
 	sigset_t ss;
+	int opt;
 	int r;
 
+	clock_gettime(CLOCK_MONOTONIC, &started);
 	memset(&context, 0x00, sizeof(daemon_state_t));
+	context.swupd_fd = -1;
+	context.peer_fd = -1;
+
+	while ((opt = getopt_long(argc, argv, "hc:", prog_opts, NULL)) != -1) {
+		switch (opt) {
+		case 'c':
+			config_file = optarg;
+			break;
+		case 'h':
+			print_help(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			print_help(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	config_init(&context.config);
+	r = config_load(&context.config, config_file);
+	if (r < 0) {
+		goto finish;
+	}
+	/* Resolve swupd once instead of searching $PATH for each request */
+	r = child_resolve(SWUPD_CLIENT, &context.swupd_path, &context.swupd_fd);
+	if (r < 0) {
+		ERR("Can't find %s: %s", SWUPD_CLIENT, strerror(-r));
+	}
+
+	context.schedule.hash = schedule_hash_file(context.config.machine_id_path ?
+						   context.config.machine_id_path :
+						   SCHEDULE_DEFAULT_MACHINE_ID_PATH);
+	context.schedule.jitter = context.config.schedule_jitter;
+	memcpy(context.schedule.interval, context.config.schedule_interval,
+	       sizeof(context.schedule.interval));
+	if (context.config.maintenance_window &&
+	    schedule_parse_window(&context.schedule, context.config.maintenance_window) < 0) {
+		ERR("Invalid maintenance window '%s', ignoring it", context.config.maintenance_window);
+	}
+	schedule_load(&context.schedule, SCHEDULE_STATE_FILE);
+	staging_load(&context.staging, STAGING_STATE_FILE);
+	context.idle.mode = context.config.idle_mode;
+	context.idle.min_usec = (uint64_t) context.config.idle_timeout_min * 1000000;
+	context.idle.max_usec = (uint64_t) context.config.idle_timeout_max * 1000000;
+	idle_load(&context.idle, IDLE_STATE_FILE);
+	osinfo_init(&context.os);
+	osinfo_load(&context.os, OSINFO_STATE_FILE);
+	context.os.installed_version = osinfo_read_version(OSINFO_OS_RELEASE_FILE);
+
+	if (!context.config.max_running_jobs) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		context.config.max_running_jobs = cpus > 0 ? cpus : 1;
+	}
 
         r = sd_event_default(&event);
         if (r < 0) {
                 ERR("Failed to allocate event loop: %s", strerror(-r));
                 goto finish;
         }
+	context.event = event;
 
 	if (sigemptyset(&ss) < 0 ||
 	    sigaddset(&ss, SIGCHLD) < 0) {
@@ -927,24 +4304,103 @@ int main(int argc, char *argv[]) {
 
 	sd_bus_slot_set_userdata(slot, &context);
 
+	r = sd_bus_add_filter(context.bus, NULL, on_incoming_message, &context);
+	if (r < 0) {
+		ERR("Failed to add message filter: %s", strerror(-r));
+		goto finish;
+	}
+
+	r = sd_bus_add_fallback_vtable(context.bus,
+				       &job_slot,
+				       JOB_OBJECT_PATH,
+				       JOB_INTERFACE,
+				       job_vtable,
+				       find_job_object,
+				       &context);
+	if (r >= 0) {
+		r = sd_bus_add_node_enumerator(context.bus, &enumerator_slot, JOB_OBJECT_PATH,
+					       enumerate_jobs, &context);
+	}
+	if (r < 0) {
+		ERR("Failed to register job objects: %s", strerror(-r));
+		goto finish;
+	}
+
+	r = sd_bus_track_new(context.bus, &context.monitors, NULL, NULL);
+	if (r >= 0) {
+		r = sd_bus_track_new(context.bus, &context.error_monitors, NULL, NULL);
+	}
+	if (r < 0) {
+		ERR("Failed to track monitors: %s", strerror(-r));
+		goto finish;
+	}
+
 	r = sd_bus_request_name(context.bus, "org.O1.swupdd.Client", 0);
 	if (r < 0) {
 		ERR("Failed to acquire service name: %s", strerror(-r));
 		goto finish;
 	}
 
-        r = sd_bus_attach_event(context.bus, event, 0);
+        r = sd_bus_attach_event(context.bus, event, SD_EVENT_PRIORITY_NORMAL);
         if (r < 0) {
                 ERR("Failed to attach bus to event loop: %s", strerror(-r));
 		goto finish;
 	}
 
-	sd_notify(false,
-		  "READY=1\n"
-		  "STATUS=Daemon startup completed, processing events.");
+	if (context.config.peer_socket) {
+		r = listen_for_peers(&context);
+		if (r < 0) {
+			ERR("Can't listen on %s: %s", PEER_SOCKET_PATH, strerror(-r));
+		}
+	}
+
+	arm_schedule_timer(&context);
+
+	context.status_page = status_page_open(STATUS_PAGE_PATH);
+	publish_status(&context);
+
+	/* Tells how much bus activation costs, for tuning the idle timeout */
+	clock_gettime(CLOCK_MONOTONIC, &ready);
+	context.startup_usec = (uint64_t) (ready.tv_sec - started.tv_sec) * 1000000 +
+		(ready.tv_nsec - started.tv_nsec) / 1000;
+	context.idle.activations++;
+	context.idle.startup_usec += context.startup_usec;
+	DEBUG("Started in %" PRIu64 " usec, idle mode %s", context.startup_usec,
+	      idle_mode_name(context.idle.mode));
+
+	sd_notify(false, "READY=1");
+	notify_status(&context);
 	r = run_bus_event_loop(event, &context);
+	idle_save(&context.idle, IDLE_STATE_FILE);
 
 finish:
+	sd_event_source_unref(context.dispatch_timer);
+	sd_event_source_unref(context.pressure_timer);
+	sd_event_source_unref(context.schedule_timer);
+	sd_event_source_unref(context.output_timer);
+	sd_event_source_unref(context.progress_timer);
+	sd_event_source_unref(context.drain_source);
+	sd_event_source_unref(context.changed_source);
+	sd_event_source_unref(context.staging_source);
+	staging_scan_stop(&context.staging_scan);
+	status_page_close(context.status_page);
+	sd_event_source_unref(context.peer_source);
+	list_free_list_and_data(context.peers, free_peer);
+	if (context.peer_fd >= 0) {
+		close(context.peer_fd);
+	}
+	list_free_list_and_data(context.queue.jobs, job_free);
+	list_free_list_and_data(context.running, job_free);
+	list_free_list_and_data(context.finished, job_free);
+	config_free(&context.config);
+	free(context.swupd_path);
+	if (context.swupd_fd >= 0) {
+		close(context.swupd_fd);
+	}
+	sd_bus_track_unref(context.monitors);
+	sd_bus_track_unref(context.error_monitors);
+	sd_bus_slot_unref(enumerator_slot);
+	sd_bus_slot_unref(job_slot);
 	sd_bus_slot_unref(slot);
 	sd_bus_unref(context.bus);
 	sd_event_unref(event);